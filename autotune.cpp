@@ -0,0 +1,297 @@
+#include "autotune.hpp"
+#include "pipeline.hpp"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <thread>
+#include <limits>
+#include <filesystem>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+namespace Autotune
+{
+
+struct Candidate {
+    Pipeline::Options opts;
+    std::string dir; // where its files go
+    bool ok {false};
+    std::string output;
+    int exit_code {0};
+    double seconds {std::numeric_limits<double>::infinity()};
+};
+
+// one search dimension: ways to change the current best options
+using Variation = std::function<void(Pipeline::Options&)>;
+
+// a candidate must be this much faster than the best so far to replace it,
+// so timing noise doesn't pick the winner
+static constexpr double min_win {0.02};
+
+// the scratch directory of the running search, removed on errors too
+static std::string scratch;
+
+static void remove_scratch()
+{
+    std::error_code ec;
+    if (!scratch.empty())
+        std::filesystem::remove_all(scratch, ec);
+    scratch.clear();
+}
+
+[[noreturn]] static void fail(const std::string& msg)
+{
+    std::cout << "Error: Autotune: " << msg << std::endl;
+    remove_scratch();
+    exit(1);
+}
+
+static std::string env_or(const char* name, const char* fallback)
+{
+    const char* v = std::getenv(name);
+    return v ? v : fallback;
+}
+
+static std::string describe(const Pipeline::Options& o)
+{
+    std::ostringstream s;
+    s << o.passes
+      << " unroll=" << (o.unroll ? (o.unroll_count ? std::to_string(o.unroll_count) : "auto") : "off")
+      << " vectorize=" << (o.vectorize ? (o.vector_width ? std::to_string(o.vector_width) : "auto") : "off")
+      << " slp=" << o.slp
+      << " inline=" << (o.inline_threshold < 0 ? "default" : std::to_string(o.inline_threshold))
+      << " fast-math=" << o.fast_math;
+    return s.str();
+}
+
+// runs args[0] (looked up in PATH) with these arguments, no shell involved;
+// true if it exited with 0
+static bool spawn(std::vector<std::string> args)
+{
+    std::vector<char*> argv;
+    for (auto& a : args)
+        argv.push_back(&a[0]);
+    argv.push_back(nullptr);
+
+    pid_t pid;
+    if (posix_spawnp(&pid, argv[0], nullptr, nullptr, argv.data(), environ) != 0)
+        return false;
+    int status;
+    return waitpid(pid, &status, 0) == pid && WIFEXITED(status) && 0 == WEXITSTATUS(status);
+}
+
+// runs in a child process: rage -> .ll -> object -> executable
+static int build(const Candidate& c, const std::string& src, Compile_Func compile)
+{
+    c.opts.write_file(c.dir + "/pipeline");
+
+    int saved_stdout = dup(STDOUT_FILENO);
+    int ll = open((c.dir + "/prog.ll").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (ll < 0 || saved_stdout < 0)
+        return 1;
+    dup2(ll, STDOUT_FILENO);
+    close(ll);
+
+    std::string pipeline_arg {"--pipeline-file=" + c.dir + "/pipeline"};
+    std::vector<char*> argv {const_cast<char*>("rage"), &pipeline_arg[0], const_cast<char*>(src.c_str()), nullptr};
+    int rc = compile(3, argv.data());
+    llvm::outs().flush();
+    std::cout.flush();
+    dup2(saved_stdout, STDOUT_FILENO);
+    if (rc)
+        return rc;
+
+    bool built = spawn({env_or("LLC", "llc"), "-O3", "-filetype=obj", c.dir + "/prog.ll", "-o", c.dir + "/prog.o"})
+        && spawn({env_or("CXX", "clang++"), "-no-pie", "-pthread", c.dir + "/prog.o",
+                  env_or("RAGE_RUNTIME", "rage_runtime.o"), "-o", c.dir + "/prog"});
+    return built ? 0 : 1;
+}
+
+// builds every candidate, as many at a time as there are cores
+static void build_all(std::vector<Candidate>& cands, const std::string& src, Compile_Func compile)
+{
+    size_t jobs = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::pair<pid_t, size_t>> running;
+
+    auto wait_one = [&] {
+        int status;
+        pid_t pid = wait(&status);
+        for (auto it = running.begin(); it != running.end(); ++it) {
+            if (it->first == pid) {
+                cands[it->second].ok = WIFEXITED(status) && 0 == WEXITSTATUS(status);
+                running.erase(it);
+                return;
+            }
+        }
+    };
+
+    for (size_t i = 0; i < cands.size(); ++i) {
+        if (running.size() == jobs)
+            wait_one();
+        std::cout.flush();
+        pid_t pid = fork();
+        if (0 == pid)
+            exit(build(cands[i], src, compile));
+        if (pid < 0)
+            fail("fork failed");
+        running.emplace_back(pid, i);
+    }
+    while (!running.empty())
+        wait_one();
+}
+
+// runs the program once with stdin from input and stdout to output,
+// returns the wall time in seconds (infinity if it did not exit cleanly)
+// and stores main's return value in exit_code
+static double run_once(const std::string& prog, const std::string& input, const std::string& output, int& exit_code)
+{
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (0 == pid) {
+        int in = open(input.c_str(), O_RDONLY);
+        int out = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (in < 0 || out < 0)
+            _exit(127);
+        dup2(in, STDIN_FILENO);
+        dup2(out, STDOUT_FILENO);
+        execl(prog.c_str(), prog.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || 127 == WEXITSTATUS(status))
+        return std::numeric_limits<double>::infinity();
+    exit_code = WEXITSTATUS(status);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// timed one at a time, so candidates don't disturb each other's timings
+static void time_all(std::vector<Candidate>& cands, const std::string& input, int runs)
+{
+    for (auto& c : cands) {
+        if (!c.ok)
+            continue;
+        for (int r = 0; r < runs; ++r)
+            c.seconds = std::min(c.seconds, run_once(c.dir + "/prog", input, c.dir + "/out", c.exit_code));
+
+        std::ifstream out {c.dir + "/out"};
+        c.output.assign(std::istreambuf_iterator<char>{out}, std::istreambuf_iterator<char>{});
+    }
+}
+
+int run(const std::string& src, const std::string& input, const std::string& out_path, Compile_Func compile)
+{
+    if (access(input.c_str(), R_OK) < 0)
+        fail("cannot read input " + input);
+
+    std::string runs_env {env_or("RAGE_AUTOTUNE_RUNS", "5")};
+    char* end = nullptr;
+    long runs = std::strtol(runs_env.c_str(), &end, 10);
+    if (runs_env.empty() || *end || runs < 1 || runs > 1000000)
+        fail("RAGE_AUTOTUNE_RUNS must be a number of runs (at least 1), got '" + runs_env + "'");
+
+    char tmpl[] = "/tmp/rage-autotune-XXXXXX";
+    if (!mkdtemp(tmpl))
+        fail("cannot create a temporary directory");
+    std::string tmp {tmpl};
+    scratch = tmp;
+    size_t n_built = 0;
+
+    auto evaluate = [&](std::vector<Pipeline::Options> options) {
+        std::vector<Candidate> cands;
+        for (auto& o : options) {
+            Candidate c;
+            c.opts = o;
+            c.dir = tmp + '/' + std::to_string(n_built++);
+            if (mkdir(c.dir.c_str(), 0755) < 0)
+                fail("cannot create " + c.dir);
+            cands.push_back(std::move(c));
+        }
+        build_all(cands, src, compile);
+        time_all(cands, input, static_cast<int>(runs));
+        return cands;
+    };
+
+    // the unoptimized build defines the expected output
+    Candidate reference {evaluate({Pipeline::Options::from_opt_level('0')})[0]};
+    if (!reference.ok || reference.seconds == std::numeric_limits<double>::infinity())
+        fail("the -O0 build failed");
+    std::cout << "autotune: " << describe(reference.opts) << ": " << reference.seconds * 1e3 << " ms\n";
+
+    // a candidate must print the same and return the same from main
+    auto same_as_reference = [&](const Candidate& c) {
+        return c.ok && c.output == reference.output && c.exit_code == reference.exit_code;
+    };
+
+    Candidate best {evaluate({Pipeline::Options::from_opt_level('2')})[0]};
+    if (!same_as_reference(best))
+        best = reference;
+    else
+        std::cout << "autotune: " << describe(best.opts) << ": " << best.seconds * 1e3 << " ms\n";
+
+    std::vector<std::vector<Variation>> dimensions {
+        {
+            [](Pipeline::Options& o) { o.passes = "default<O1>"; },
+            [](Pipeline::Options& o) { o.passes = "default<O3>"; },
+        }, {
+            [](Pipeline::Options& o) { o.unroll = false; },
+            [](Pipeline::Options& o) { o.unroll = true; o.unroll_count = 2; },
+            [](Pipeline::Options& o) { o.unroll = true; o.unroll_count = 4; },
+            [](Pipeline::Options& o) { o.unroll = true; o.unroll_count = 8; },
+        }, {
+            [](Pipeline::Options& o) { o.vectorize = false; },
+            [](Pipeline::Options& o) { o.vectorize = true; o.vector_width = 2; },
+            [](Pipeline::Options& o) { o.vectorize = true; o.vector_width = 4; },
+            [](Pipeline::Options& o) { o.vectorize = true; o.vector_width = 8; },
+        }, {
+            [](Pipeline::Options& o) { o.slp = !o.slp; },
+        }, {
+            [](Pipeline::Options& o) { o.inline_threshold = 50; },
+            [](Pipeline::Options& o) { o.inline_threshold = 500; },
+            [](Pipeline::Options& o) { o.inline_threshold = 1000; },
+        }, {
+            [](Pipeline::Options& o) { o.fast_math = !o.fast_math; },
+        },
+    };
+
+    // coordinate descent: one dimension at a time, starting from the best so far
+    for (const auto& dim : dimensions) {
+        std::vector<Pipeline::Options> options;
+        for (const auto& vary : dim) {
+            options.push_back(best.opts);
+            vary(options.back());
+        }
+
+        for (auto& c : evaluate(options)) {
+            if (!same_as_reference(c)) {
+                std::cout << "autotune: " << describe(c.opts) << ": rejected\n";
+                continue;
+            }
+            std::cout << "autotune: " << describe(c.opts) << ": " << c.seconds * 1e3 << " ms\n";
+            if (c.seconds < best.seconds * (1 - min_win))
+                best = std::move(c);
+        }
+    }
+
+    best.opts.write_file(out_path);
+    std::cout << "autotune: best: " << describe(best.opts) << ": " << best.seconds * 1e3
+              << " ms, written to " << out_path << std::endl;
+
+    remove_scratch();
+    return 0;
+}
+
+}
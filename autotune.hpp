@@ -0,0 +1,27 @@
+#ifndef AUTOTUNE_HPP
+#define AUTOTUNE_HPP
+
+#include <string>
+
+namespace Autotune
+{
+
+// the compiler's entry point, run in a forked process per candidate
+using Compile_Func = int (*)(int argc, char* argv[]);
+
+// 'rage --autotune <file.ra> <input> [out]': builds the program with
+// different pipeline options, times each build on 'input' (fed to stdin)
+// and writes the fastest options to out_path as a pipeline file,
+// for later builds to use with --pipeline-file.
+//
+// Candidates are built in parallel and timed one at a time; a candidate
+// whose output or exit code differs from the -O0 build (e.g. with
+// fast-math) is dropped, and one has to beat the best so far by 2% to
+// replace it. Uses $LLC (llc), $CXX (clang++) and $RAGE_RUNTIME
+// (rage_runtime.o), each a single program or path, to build and runs every
+// binary $RAGE_AUTOTUNE_RUNS (5, at least 1) times, keeping the fastest.
+int run(const std::string& src, const std::string& input, const std::string& out_path, Compile_Func compile);
+
+}
+
+#endif
@@ -0,0 +1,17 @@
+#include <stdio.h>
+
+int main(void)
+{
+    double x = 0;
+    scanf("%lf", &x);
+    double a = x * 1.5 + 2;
+    double b = a * a - x / 3;
+    double c = b / 7 + a * 2;
+    double d = c * c - b * a;
+    double e = d / a + c / b;
+    double f = e * e + d * 0.25;
+    double g = f / c - b * 3;
+    double h = g * g + f * e;
+    printf("%lf\n", h);
+    return 0;
+}
@@ -0,0 +1,22 @@
+#include <stdio.h>
+
+int main(void)
+{
+    double x = 0;
+    scanf("%lf", &x);
+    double y = x * 2;
+    if (x != 3) {
+        if (y != 10)
+            y = y * 3 - x;
+        else
+            y = y / 2;
+    } else {
+        y = y + 100;
+    }
+    if (y != 17)
+        y = y - 1;
+    else
+        y = y + 1;
+    printf("%lf\n", y);
+    return (int)y;
+}
@@ -0,0 +1,16 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+/* gen_f64 <n> <file>: n doubles i * 0.5, native byte order */
+int main(int argc, char *argv[])
+{
+    if (argc != 3) return 1;
+    long n = atol(argv[1]);
+    FILE *f = fopen(argv[2], "wb");
+    if (!f) return 1;
+    for (long i = 0; i < n; ++i) {
+        double v = i * 0.5;
+        fwrite(&v, sizeof v, 1, f);
+    }
+    return fclose(f) != 0;
+}
@@ -0,0 +1,20 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(void)
+{
+    long n = 1000000;
+    FILE *f = fopen("io.f64", "rb");
+    if (!f) return 1;
+    double *a = malloc((size_t)n * sizeof(double));
+    if (fread(a, sizeof(double), (size_t)n, f) != (size_t)n) return 1;
+    fclose(f);
+
+    for (long i = 0; i < n; ++i)
+        a[i] = a[i] * 2 + 1;
+    double s = 0;
+    for (long i = 0; i < n; ++i)
+        s = s + a[i];
+    printf("%lf\n", s);
+    return 0;
+}
@@ -0,0 +1,52 @@
+# parallel lexing: generates a big source (strings with spaces and
+# markers in them, CRLF lines, long and short lines), checks that
+# --lex-threads=1 and --lex-threads=N give the same tokens (types, values
+# and positions) and prints the lexing time of both
+# usage: bench/lex.sh [MiB] [runs]    (build ./rage first, see compile_main.sh)
+# env:   RAGE THREADS OUT
+mib=${1:-64}
+runs=${2:-5}
+RAGE=${RAGE:-./rage}
+THREADS=${THREADS:-$(nproc)}
+out=${OUT:-$(mktemp -d)}
+mkdir -p "$out" || exit 1
+src=$out/lex.ra
+
+awk -v bytes=$((mib << 20)) 'BEGIN {
+    n = 0
+    while (n < bytes) {
+        i++
+        line = "    float x" i " = " i " * 2.5 + y" (i % 7) " / (3 - z)"
+        if (i % 5 == 0) line = "    stream.out a" i " to \"out " i " {#[=]} .f64\""
+        if (i % 11 == 0) line = line "\r"
+        if (i % 13 == 0) line = ""
+        if (i % 17 == 0) { line = "   "; for (k = 0; k < 40; k++) line = line " v" k " +"; line = line " 1" }
+        print line
+        n += length(line) + 1
+    }
+}' > "$src"
+
+"$RAGE" --lex-threads=1 "$src" dump > "$out/tokens.1" || exit 1
+"$RAGE" --lex-threads="$THREADS" "$src" dump > "$out/tokens.$THREADS" || exit 1
+if ! cmp -s "$out/tokens.1" "$out/tokens.$THREADS"; then
+    echo "lex: --lex-threads=$THREADS differs from --lex-threads=1 (see $out/tokens.*)"
+    exit 1
+fi
+
+# best of 'runs', in milliseconds
+time_ms() {
+    local best=0 t0 t1
+    for _ in $(seq "$runs"); do
+        t0=$(date +%s%N)
+        "$RAGE" --lex-only --lex-threads="$1" "$src" > /dev/null
+        t1=$(date +%s%N)
+        [ "$best" = 0 ] || [ $((t1 - t0)) -lt "$best" ] && best=$((t1 - t0))
+    done
+    echo $((best / 1000000))
+}
+
+t1=$(time_ms 1)
+tn=$(time_ms "$THREADS")
+printf '%s MiB, %s tokens: 1 thread %d ms, %d threads %d ms, speedup %.2f\n' "$mib" \
+    "$(wc -l < "$out/tokens.1")" "$t1" "$THREADS" "$tn" "$(awk "BEGIN { print $t1 / ($tn ? $tn : 1) }")"
+[ -n "$OUT" ] || rm -rf "$out"
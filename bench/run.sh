@@ -0,0 +1,74 @@
+# Runs every bench/<kernel>.ra against its C reference bench/<kernel>.c
+# at several optimization levels, with the fixed input <kernel>.in.
+# Checks that output and exit code match and reports time per run,
+# user-space instructions (if perf works) and binary size.
+#
+# usage: bench/run.sh [runs]    (build ./rage and ./rage_runtime.o first, see compile_main.sh)
+# env:   RAGE RUNTIME CC CXX OPT_LEVELS OUT RAGE_NUM_THREADS
+cd "$(dirname "$0")"
+src=$PWD
+runs=${1:-20}
+RAGE=${RAGE:-../rage}
+RUNTIME=${RUNTIME:-../rage_runtime.o}
+CC=${CC:-clang}
+CXX=${CXX:-clang++}
+OPT_LEVELS=${OPT_LEVELS:-"0 1 2 3"}
+out=${OUT:-build}
+status=0
+# the C twins run on one core, so 'parallel for' kernels do too
+export RAGE_NUM_THREADS=${RAGE_NUM_THREADS:-1}
+
+mkdir -p "$out" || exit 1
+$CC -O2 gen_f64.c -o "$out/gen_f64" && "$out/gen_f64" 1000000 "$out/io.f64" || exit 1
+
+perf_ok=0
+perf stat -x, -e instructions:u true > /dev/null 2>&1 && perf_ok=1
+
+# prints microseconds per run of binary $1 on input $2 (run from $out)
+time_us() {
+    local t0 t1
+    t0=$(date +%s%N)
+    for _ in $(seq "$runs"); do (cd "$out" && "./$1" < "$src/$2" > /dev/null); done
+    t1=$(date +%s%N)
+    echo $(( (t1 - t0) / runs / 1000 ))
+}
+
+instructions() {
+    [ "$perf_ok" = 1 ] || { echo -; return; }
+    (cd "$out" && perf stat -x, -e instructions:u "./$1" < "$src/$2" 2>&1 > /dev/null | tail -1 | cut -d, -f1)
+}
+
+printf '%-10s %3s %10s %10s %7s %12s %12s %9s %9s\n' \
+    kernel opt rage_us c_us ratio rage_insns c_insns rage_B c_B
+
+for ra in *.ra; do
+    k=${ra%.ra}
+    "$RAGE" "$ra" > "$out/$k.ll" || { echo "$k: rage failed"; status=1; continue; }
+
+    for O in $OPT_LEVELS; do
+        r=$k.O$O.rage
+        c=$k.O$O.c
+        opt -O$O "$out/$k.ll" -o "$out/$k.O$O.bc" \
+            && llc -O$O -filetype=obj "$out/$k.O$O.bc" -o "$out/$k.O$O.o" \
+            && $CXX -no-pie -pthread "$out/$k.O$O.o" "$RUNTIME" -o "$out/$r" \
+            && $CC -O$O "$k.c" -o "$out/$c" \
+            || { echo "$k -O$O: build failed"; status=1; continue; }
+
+        (cd "$out" && "./$r" < "$src/$k.in" > "$r.out"; echo "exit $?" >> "$r.out")
+        (cd "$out" && "./$c" < "$src/$k.in" > "$c.out"; echo "exit $?" >> "$c.out")
+        if ! cmp -s "$out/$r.out" "$out/$c.out"; then
+            echo "$k -O$O: output differs from C (see $out/$r.out)"
+            status=1
+            continue
+        fi
+
+        rt=$(time_us "$r" "$k.in")
+        ct=$(time_us "$c" "$k.in")
+        printf '%-10s %3s %10d %10d %7.2f %12s %12s %9d %9d\n' "$k" "-O$O" "$rt" "$ct" \
+            "$(awk "BEGIN { print $rt / ($ct ? $ct : 1) }")" \
+            "$(instructions "$r" "$k.in")" "$(instructions "$c" "$k.in")" \
+            "$(stat -c %s "$out/$r")" "$(stat -c %s "$out/$c")"
+    done
+done
+
+exit $status
@@ -0,0 +1,27 @@
+# cold (one process per file) vs warm (rage --server) compile latency
+# usage: bench/server.sh [runs] file.ra...    (build ./rage first, see compile_main.sh)
+# env:   RAGE CLIENT
+runs=${1:-100}; shift
+RAGE=${RAGE:-./rage}
+dir=$(mktemp -d)
+export RAGE_SOCKET=${RAGE_SOCKET:-$dir/rage.sock}
+
+"$RAGE" --server "$RAGE_SOCKET" > /dev/null &
+server=$!
+trap 'kill $server; rm -f "$RAGE_SOCKET"; rm -rf "$dir"' EXIT
+while [ ! -S "$RAGE_SOCKET" ]; do sleep 0.05; done
+
+now() { date +%s%N; }
+client="$RAGE --client"
+[ -x ./rage-client ] && client=./rage-client
+client=${CLIENT:-$client}
+
+printf '%-30s %12s %12s\n' file cold_us warm_us
+for f in "$@"; do
+    t0=$(now)
+    for _ in $(seq "$runs"); do "$RAGE" "$f" > /dev/null; done
+    t1=$(now)
+    for _ in $(seq "$runs"); do $client "$f" > /dev/null; done
+    t2=$(now)
+    printf '%-30s %12d %12d\n' "$f" $(( (t1-t0)/runs/1000 )) $(( (t2-t1)/runs/1000 ))
+done
@@ -0,0 +1,109 @@
+# Compares the ways of running a script: 'rage --run=interp', '--run=jit',
+# '--run' (tiered) and ahead-of-time (rage -O2 | llc | link, then run).
+# Scripts of growing size (straight-line 'lines', and a 'loop' going round
+# a parallel for more and more times) are generated; for each, reports the
+# time until the first line of output and the total time, both including
+# compilation.
+#
+# usage: bench/tiers.sh [runs]    (build ./rage and ./rage_runtime.o first, see compile_main.sh)
+# env:   RAGE RUNTIME CXX SIZES ITERS OUT
+cd "$(dirname "$0")"
+runs=${1:-5}
+RAGE=${RAGE:-../rage}
+RUNTIME=${RUNTIME:-../rage_runtime.o}
+CXX=${CXX:-clang++}
+SIZES=${SIZES:-"100 1000 10000 50000"}
+ITERS=${ITERS:-"1000 100000 10000000"}
+out=${OUT:-build}
+status=0
+
+mkdir -p "$out" || exit 1
+case $out in /*) ;; *) out=$PWD/$out ;; esac
+case $RAGE in /*) ;; *) RAGE=$PWD/$RAGE ;; esac
+case $RUNTIME in /*) ;; *) RUNTIME=$PWD/$RUNTIME ;; esac
+# stdout is a pipe here: line buffered, the first line shows up when it is printed
+lb="stdbuf -oL"
+
+# main prints right away, then runs n statements
+gen_lines() {
+    echo 'int32 main() {'
+    echo '    float x = 1'
+    echo '    stream.out x'
+    for i in $(seq $(($1 / 2))); do
+        echo "    x = x * 0.5"
+        echo "    x = x + $i"
+    done
+    echo '    stream.out x'
+    echo '    return 0'
+    echo '}'
+}
+
+# main prints right away, then goes round a loop n times
+gen_loop() {
+    echo 'int32 main() {'
+    echo '    float x = 1'
+    echo '    stream.out x'
+    echo '    float s = 0'
+    echo "    parallel for i = 1 to $1 reduce + s {"
+    echo '        s = s + i * 0.5'
+    echo '    }'
+    echo '    stream.out s'
+    echo '    return 0'
+    echo '}'
+}
+
+# runs "$@", prints "<us to first line> <us total>"
+measure() {
+    local t0 first t1
+    t0=$(date +%s%N)
+    first=$("$@" | { read -r _; date +%s%N; cat > /dev/null; })
+    t1=$(date +%s%N)
+    echo $(( (first - t0) / 1000 )) $(( (t1 - t0) / 1000 ))
+}
+
+aot() {
+    "$RAGE" -O2 "$1" > "$1.ll" && llc -O2 -filetype=obj "$1.ll" -o "$1.o" \
+        && $CXX -no-pie -pthread "$1.o" "$RUNTIME" -o "$1.bin" && $lb "$1.bin"
+}
+
+# average of "first total" pairs over $runs runs
+average() {
+    local f=0 t=0 a b
+    for _ in $(seq "$runs"); do
+        read -r a b < <(measure "$@")
+        f=$((f + a)); t=$((t + b))
+    done
+    echo $((f / runs)) $((t / runs))
+}
+
+# bench <kind> <size>
+bench() {
+    local ra=$out/tiers.$1.$2.ra expected tier cmd first total
+    gen_$1 "$2" > "$ra"
+
+    expected=$("$RAGE" --run=jit "$ra")
+    for tier in interp jit tiered aot; do
+        case $tier in
+            tiered) cmd=($lb "$RAGE" --run "$ra") ;;
+            aot)    cmd=(aot "$ra") ;;
+            *)      cmd=($lb "$RAGE" --run=$tier "$ra") ;;
+        esac
+        if [ "$("${cmd[@]}")" != "$expected" ]; then
+            echo "$1 $2 $tier: output differs"
+            status=1
+            continue
+        fi
+        read -r first total < <(average "${cmd[@]}")
+        printf '%-6s %-10s %-8s %12d %12d\n' "$1" "$2" "$tier" "$first" "$total"
+    done
+}
+
+printf '%-6s %-10s %-8s %12s %12s\n' script size tier first_us total_us
+for n in $SIZES; do
+    bench lines "$n"
+done
+for n in $ITERS; do
+    bench loop "$n"
+done
+
+exit $status
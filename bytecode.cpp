@@ -0,0 +1,466 @@
+#include "bytecode.hpp"
+#include "parser.hpp"
+
+#include <cstdio>
+#include <cmath>
+
+namespace Bytecode
+{
+
+int32_t Function_Builder::constant(double v)
+{
+    fn.consts.push_back(v);
+    return static_cast<int32_t>(fn.consts.size() - 1);
+}
+
+int32_t Function_Builder::string(const std::string& s)
+{
+    fn.strings.push_back(s);
+    return static_cast<int32_t>(fn.strings.size() - 1);
+}
+
+size_t Function_Builder::emit(Op op, int32_t a, int32_t b, int32_t c)
+{
+    fn.code.push_back(Instr{op, a, b, c});
+    return fn.code.size() - 1;
+}
+
+int32_t Function_Builder::var(const std::string& name) const
+{
+    auto it = vars.find(name);
+    if (vars.end() == it)
+        ERROR(std::string{"var name " + name + " not recognized"}.c_str());
+    return it->second;
+}
+
+// like codegen(), a second declaration shadows the first
+int32_t Function_Builder::declare_var(const std::string& name)
+{
+    shared.erase(name);
+    return vars[name] = new_reg();
+}
+
+int32_t Function_Builder::array(const std::string& name) const
+{
+    auto it = array_slots.find(name);
+    if (array_slots.end() == it)
+        ERROR(std::string{"array " + name + " not recognized"}.c_str());
+    return it->second;
+}
+
+int32_t Function_Builder::declare_array(const std::string& name, Runtime::Elem_Kind kind)
+{
+    shared.erase(name);
+    fn.arrays.push_back(kind);
+    return array_slots[name] = static_cast<int32_t>(fn.arrays.size() - 1);
+}
+
+int32_t Function_Builder::new_loop(Semantic_Parser::Parallel_For_AST& ast)
+{
+    fn.loops.emplace_back();
+    fn.loops.back().ast = &ast;
+    return static_cast<int32_t>(fn.loops.size() - 1);
+}
+
+void Function_Builder::enter_parallel(int32_t loop)
+{
+    parallel = true;
+    top = loop;
+    for (const auto& v : vars)
+        shared.insert(v.first);
+    for (const auto& a : array_slots)
+        shared.insert(a.first);
+}
+
+void Function_Builder::check_assignable(const std::string& name, const char* where) const
+{
+    if (shared.count(name))
+        ERROR(std::string{std::string{where} + ": " + name + " is shared by the threads of a parallel for,"
+            " only the 'reduce' variable can be assigned"}.c_str());
+}
+
+void Function_Builder::unsupported(const std::string& what)
+{
+    if (supported)
+        reason = what;
+    supported = false;
+}
+
+std::unique_ptr<Function> compile(Semantic_Parser::Function_AST& f, std::string& why)
+{
+    auto fn = std::make_unique<Function>();
+    fn->name = f.name;
+    Function_Builder fb {*fn};
+    f.bytecode(fb);
+    if (!fb.ok()) {
+        why = fb.why();
+        return nullptr;
+    }
+    return fn;
+}
+
+static int64_t elem_size(Runtime::Elem_Kind kind)
+{
+    switch (kind) {
+    case Runtime::Elem_Kind::F64: return sizeof(double);
+    case Runtime::Elem_Kind::F32: return sizeof(float);
+    case Runtime::Elem_Kind::I32: return sizeof(int32_t);
+    case Runtime::Elem_Kind::I8:  return sizeof(int8_t);
+    }
+    return 1;
+}
+
+int32_t Interpreter::call(Function& f)
+{
+    if (Native_Func native = f.native.load(std::memory_order_acquire))
+        return native();
+    // a frame that is already running stays in the interpreter, but its
+    // loops switch to their compiled bodies (see PLOOP)
+    if (hot && f.calls.fetch_add(1, std::memory_order_relaxed) + 1 == hot_threshold)
+        hot(f);
+    return interpret(f);
+}
+
+namespace {
+struct Array {
+    void* data {nullptr};
+    int64_t len {0};
+};
+}
+
+// With GCC/Clang every handler jumps straight to the next one through a
+// table of label addresses ("threaded" dispatch), which gives the branch
+// predictor one indirect jump per handler instead of a single shared one.
+// Other compilers get the plain switch loop.
+#if defined(__GNUC__)
+#define RAGE_THREADED_DISPATCH 1
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+int32_t Interpreter::interpret(Function& f)
+{
+    std::vector<double> r(f.n_regs);
+    std::vector<Array> arrays(f.arrays.size());
+    const Instr *code = f.code.data();
+    const Instr *ip = code;
+
+#ifdef RAGE_THREADED_DISPATCH
+    static const void *labels[] = {
+#define X(op) &&L_##op,
+        RAGE_BYTECODE_OPS(X)
+#undef X
+    };
+#define CASE(op) L_##op:
+#define DISPATCH() goto *labels[static_cast<size_t>(ip->op)]
+    DISPATCH();
+    {
+#else
+#define CASE(op) case Op::op:
+#define DISPATCH() goto dispatch
+dispatch:
+    switch (ip->op) {
+#endif
+#define NEXT() do { ++ip; DISPATCH(); } while (0)
+#define JUMP(to) do { ip = code + (to); DISPATCH(); } while (0)
+
+    CASE(LOADK) r[ip->a] = f.consts[ip->b]; NEXT();
+    CASE(MOV)   r[ip->a] = r[ip->b]; NEXT();
+    CASE(ADD)   r[ip->a] = r[ip->b] + r[ip->c]; NEXT();
+    CASE(SUB)   r[ip->a] = r[ip->b] - r[ip->c]; NEXT();
+    CASE(MUL)   r[ip->a] = r[ip->b] * r[ip->c]; NEXT();
+    CASE(DIV)   r[ip->a] = r[ip->b] / r[ip->c]; NEXT();
+    CASE(JMP)   JUMP(ip->a);
+    CASE(LOOP)
+        if (hot && ++f.loops[ip->b].back_edges == hot_threshold)
+            hot(f);
+        JUMP(ip->a);
+    CASE(JZ)
+        if (!(r[ip->a] < 0.0 || r[ip->a] > 0.0))
+            JUMP(ip->b);
+        NEXT();
+    CASE(JGT)
+        if (r[ip->a] > r[ip->b])
+            JUMP(ip->c);
+        NEXT();
+    CASE(TRUNC) r[ip->a] = std::trunc(r[ip->b]); NEXT();
+    CASE(RET)   return static_cast<int32_t>(r[ip->a]);
+    CASE(IN)    std::scanf("%lf", &r[ip->a]); NEXT();
+    CASE(OUT)   std::printf("%lf\n", r[ip->a]); NEXT();
+    CASE(ANEW) {
+        Array& arr = arrays[ip->a];
+        arr.len = static_cast<int64_t>(f.consts[ip->b]);
+        arr.data = rage_array_alloc(arr.len, elem_size(f.arrays[ip->a]));
+        NEXT();
+    }
+    CASE(ALOAD_F64) r[ip->a] = static_cast<double*>(arrays[ip->b].data)[static_cast<int64_t>(r[ip->c])]; NEXT();
+    CASE(ALOAD_F32) r[ip->a] = static_cast<float*>(arrays[ip->b].data)[static_cast<int64_t>(r[ip->c])]; NEXT();
+    CASE(ALOAD_I32) r[ip->a] = static_cast<int32_t*>(arrays[ip->b].data)[static_cast<int64_t>(r[ip->c])]; NEXT();
+    CASE(ALOAD_I8)  r[ip->a] = static_cast<int8_t*>(arrays[ip->b].data)[static_cast<int64_t>(r[ip->c])]; NEXT();
+    CASE(ASTORE_F64) static_cast<double*>(arrays[ip->a].data)[static_cast<int64_t>(r[ip->b])] = r[ip->c]; NEXT();
+    CASE(ASTORE_F32) static_cast<float*>(arrays[ip->a].data)[static_cast<int64_t>(r[ip->b])] = static_cast<float>(r[ip->c]); NEXT();
+    CASE(ASTORE_I32) static_cast<int32_t*>(arrays[ip->a].data)[static_cast<int64_t>(r[ip->b])] = static_cast<int32_t>(r[ip->c]); NEXT();
+    CASE(ASTORE_I8)  static_cast<int8_t*>(arrays[ip->a].data)[static_cast<int64_t>(r[ip->b])] = static_cast<int8_t>(r[ip->c]); NEXT();
+    CASE(AMAP) {
+        Array& arr = arrays[ip->a];
+        arr.data = rage_array_map(f.strings[ip->b].c_str(), elem_size(f.arrays[ip->a]), &arr.len, arr.data);
+        NEXT();
+    }
+    CASE(AWRITE)
+        rage_array_write(f.strings[ip->b].c_str(), arrays[ip->a].data, arrays[ip->a].len * elem_size(f.arrays[ip->a]));
+        NEXT();
+    CASE(APRINT) rage_array_print(arrays[ip->a].data, arrays[ip->a].len, static_cast<int32_t>(f.arrays[ip->a])); NEXT();
+    CASE(ASCAN)  rage_array_scan(arrays[ip->a].data, arrays[ip->a].len, static_cast<int32_t>(f.arrays[ip->a])); NEXT();
+    CASE(PCHUNK)
+        r[ip->a] = static_cast<double>(rage_parallel_chunk_size(static_cast<int64_t>(r[ip->b]), static_cast<int64_t>(r[ip->c]) + 1));
+        NEXT();
+    CASE(PLOOP) {
+        Loop& l = f.loops[ip->a];
+        Rage_Parallel_Body body = l.native.load(std::memory_order_acquire);
+        if (!body)
+            NEXT();
+        // the same chunks from here on, combined into the same total, so
+        // the reduction doesn't depend on when the switch happened
+        std::vector<void*> ctx;
+        for (int32_t s : l.scalars)
+            ctx.push_back(&r[s]);
+        for (int32_t a : l.arrays) {
+            ctx.push_back(&arrays[a].data);
+            ctx.push_back(&arrays[a].len);
+        }
+        r[l.total] = rage_parallel_for_chunks(static_cast<int64_t>(r[l.n]), static_cast<int64_t>(r[l.last]) + 1,
+            static_cast<int64_t>(r[l.size]), r[l.total], l.op, body, ctx.data());
+        JUMP(l.end);
+    }
+    }
+
+#undef CASE
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+    return 0;
+}
+
+#ifdef RAGE_THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif
+
+}
+
+namespace Semantic_Parser
+{
+using Bytecode::Op;
+
+int Binary_Expr_AST::bytecode(Bytecode::Function_Builder& fb)
+{
+    int32_t L = LHS->bytecode(fb);
+    int32_t R = RHS->bytecode(fb);
+    int32_t d = fb.new_reg();
+    switch (op) {
+    case Math_Op::PLUS:  fb.emit(Op::ADD, d, L, R); break;
+    case Math_Op::MINUS: fb.emit(Op::SUB, d, L, R); break;
+    case Math_Op::MULT:  fb.emit(Op::MUL, d, L, R); break;
+    case Math_Op::DIV:   fb.emit(Op::DIV, d, L, R); break;
+    }
+    return d;
+}
+
+int Number_Expr_AST::bytecode(Bytecode::Function_Builder& fb)
+{
+    int32_t d = fb.new_reg();
+    fb.emit(Op::LOADK, d, fb.constant(val));
+    return d;
+}
+
+int Var_Expr_AST::bytecode(Bytecode::Function_Builder& fb)
+{
+    return fb.var(name);
+}
+
+int Reduce_Expr_AST::bytecode(Bytecode::Function_Builder& fb)
+{
+    fb.unsupported("vector reductions");
+    return fb.new_reg();
+}
+
+int Array_Elem_Expr_AST::bytecode(Bytecode::Function_Builder& fb)
+{
+    static const Op loads[] = {Op::ALOAD_F64, Op::ALOAD_F32, Op::ALOAD_I32, Op::ALOAD_I8};
+    if (!fb.has_array(name)) {
+        fb.unsupported("vector lanes");
+        return fb.new_reg();
+    }
+    int32_t arr = fb.array(name);
+    int32_t i = index->bytecode(fb);
+    int32_t d = fb.new_reg();
+    fb.emit(loads[static_cast<int>(fb.array_kind(arr))], d, arr, i);
+    return d;
+}
+
+void Var_Declaration_AST::bytecode(Bytecode::Function_Builder& fb)
+{
+    if (is_vector_type(data_type))
+        fb.unsupported("vector types");
+    int32_t v = expr->bytecode(fb);
+    fb.emit(Op::MOV, fb.declare_var(var_name), v);
+}
+
+void Var_Assignment_AST::bytecode(Bytecode::Function_Builder& fb)
+{
+    fb.check_assignable(id, "In VarAssignment_AST::bytecode()");
+    int32_t v = expr->bytecode(fb);
+    fb.emit(Op::MOV, fb.var(id), v);
+}
+
+void Array_Declaration_AST::bytecode(Bytecode::Function_Builder& fb)
+{
+    int32_t arr = fb.declare_array(var_name, array_elem_kind(data_type));
+    fb.emit(Op::ANEW, arr, fb.constant(static_cast<double>(size)));
+}
+
+void Array_Assignment_AST::bytecode(Bytecode::Function_Builder& fb)
+{
+    static const Op stores[] = {Op::ASTORE_F64, Op::ASTORE_F32, Op::ASTORE_I32, Op::ASTORE_I8};
+    if (!fb.has_array(id)) {
+        fb.unsupported("vector lanes");
+        return;
+    }
+    int32_t arr = fb.array(id);
+    int32_t v = expr->bytecode(fb);
+    int32_t i = index->bytecode(fb);
+    fb.emit(stores[static_cast<int>(fb.array_kind(arr))], arr, i, v);
+}
+
+void Return_AST::bytecode(Bytecode::Function_Builder& fb)
+{
+    fb.emit(Op::RET, expr->bytecode(fb));
+}
+
+void If_Else_AST::bytecode(Bytecode::Function_Builder& fb)
+{
+    size_t to_else = fb.emit(Op::JZ, cond->bytecode(fb));
+    for (const auto& stm : if_body)
+        stm->bytecode(fb);
+    size_t to_merge = fb.emit(Op::JMP);
+
+    fb.at(to_else).b = static_cast<int32_t>(fb.here());
+    for (const auto& stm : else_body)
+        stm->bytecode(fb);
+    fb.at(to_merge).a = static_cast<int32_t>(fb.here());
+}
+
+// The interpreter has one thread: the chunks run one after the other, cut
+// the way rage_parallel_for cuts them (a nested loop is a single chunk).
+// As in codegen(), the body sees the reduce variable as its chunk's
+// accumulator, starting at the identity, and the chunks' parts are
+// combined in order into the variable after the loop.
+// A top level loop checks for its compiled body before every chunk, and
+// the back-edges of its body (nested loops included) count towards the
+// function becoming hot.
+void Parallel_For_AST::bytecode(Bytecode::Function_Builder& fb)
+{
+    bool top = !fb.in_parallel();
+    int32_t n = fb.new_reg();
+    int32_t last = fb.new_reg();
+    int32_t one = fb.new_reg();
+    int32_t size = fb.new_reg();
+    fb.emit(Op::TRUNC, n, from->bytecode(fb));
+    fb.emit(Op::TRUNC, last, to->bytecode(fb));
+    fb.emit(Op::LOADK, one, fb.constant(1.0));
+    if (fb.in_parallel())
+        fb.emit(Op::LOADK, size, fb.constant(HUGE_VAL));
+    else
+        fb.emit(Op::PCHUNK, size, n, last);
+
+    Op combine = '*' == reduce_op ? Op::MUL : Op::ADD;
+    int32_t identity = fb.constant('*' == reduce_op ? 1.0 : 0.0);
+    int32_t s = 0;
+    int32_t total = fb.new_reg();
+    if (reduce_op) {
+        s = fb.var(reduce_var);
+        fb.check_assignable(reduce_var, "In Parallel_For_AST::bytecode()");
+        fb.emit(Op::LOADK, total, identity);
+    }
+
+    int32_t id = top ? fb.new_loop(*this) : fb.top_loop();
+    if (top) {
+        Bytecode::Loop& l = fb.loop(id);
+        l.n = n;
+        l.last = last;
+        l.size = size;
+        l.total = total;
+        l.op = '*' == reduce_op ? '*' : '+';
+        for (const auto& [name, reg] : fb.visible_vars())
+            if (name != reduce_var && name != var)
+                l.scalars.push_back(reg);
+        for (const auto& a : fb.visible_arrays())
+            l.arrays.push_back(a.second);
+    }
+
+    Bytecode::Function_Builder::Scope outer = fb.begin_scope();
+    fb.enter_parallel(id);
+    int32_t acc = reduce_op ? fb.declare_var(reduce_var) : 0;
+    int32_t i = fb.declare_var(var);
+    int32_t chunk_last = fb.new_reg();
+
+    size_t chunk = fb.here();
+    if (top)
+        fb.emit(Op::PLOOP, id);
+    size_t to_end = fb.emit(Op::JGT, n, last);
+    if (reduce_op)
+        fb.emit(Op::LOADK, acc, identity);
+    fb.emit(Op::ADD, chunk_last, n, size);
+    fb.emit(Op::SUB, chunk_last, chunk_last, one);
+
+    size_t next = fb.here();
+    size_t chunk_done = fb.emit(Op::JGT, n, chunk_last);
+    size_t loop_done = fb.emit(Op::JGT, n, last);
+    fb.emit(Op::MOV, i, n);
+    for (const auto& stm : body)
+        stm->bytecode(fb);
+    fb.emit(Op::ADD, n, n, one);
+    fb.emit(Op::LOOP, static_cast<int32_t>(next), id);
+
+    fb.at(chunk_done).c = fb.at(loop_done).c = static_cast<int32_t>(fb.here());
+    if (reduce_op)
+        fb.emit(combine, total, total, acc);
+    fb.emit(Op::JMP, static_cast<int32_t>(chunk));
+    fb.at(to_end).c = static_cast<int32_t>(fb.here());
+    if (top)
+        fb.loop(id).end = static_cast<int32_t>(fb.here());
+    fb.end_scope(std::move(outer));
+    if (reduce_op)
+        fb.emit(combine, s, s, total);
+}
+
+void Function_AST::bytecode(Bytecode::Function_Builder& fb)
+{
+    for (auto& s : body)
+        s->bytecode(fb);
+
+    // falling off the end (only if the code ends in an if/else that
+    // returns on both sides) must not run past the last instruction
+    int32_t zero = fb.new_reg();
+    fb.emit(Op::LOADK, zero, fb.constant(0.0));
+    fb.emit(Op::RET, zero);
+}
+
+void Stream_AST::bytecode(Bytecode::Function_Builder& fb)
+{
+    bool in = internal_func_name == "scanf";
+    if (!file.empty()) {
+        if (in)
+            fb.check_assignable(id, "In Stream_AST::bytecode()");
+        fb.emit(in ? Op::AMAP : Op::AWRITE, fb.array(id), fb.string(file));
+        return;
+    }
+    if (fb.has_array(id)) {
+        fb.emit(in ? Op::ASCAN : Op::APRINT, fb.array(id));
+        return;
+    }
+    if (in)
+        fb.check_assignable(id, "In Stream_AST::bytecode()");
+    fb.emit(in ? Op::IN : Op::OUT, fb.var(id));
+}
+
+}
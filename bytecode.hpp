@@ -0,0 +1,194 @@
+#ifndef BYTECODE_HPP
+#define BYTECODE_HPP
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+
+#include "runtime.hpp"
+
+namespace Semantic_Parser { class Function_AST; class Parallel_For_AST; }
+
+// Register based bytecode for the interpreter tier ('rage --run').
+// Every value is a double in a register, arrays live in their own slots.
+namespace Bytecode
+{
+
+#define RAGE_BYTECODE_OPS(X) \
+    X(LOADK)   /* r[a] = consts[b]                                   */ \
+    X(MOV)     /* r[a] = r[b]                                        */ \
+    X(ADD)     /* r[a] = r[b] + r[c]                                 */ \
+    X(SUB)     /* r[a] = r[b] - r[c]                                 */ \
+    X(MUL)     /* r[a] = r[b] * r[c]                                 */ \
+    X(DIV)     /* r[a] = r[b] / r[c]                                 */ \
+    X(JMP)     /* pc = a                                             */ \
+    X(LOOP)    /* pc = a, a back-edge of loops[b]                    */ \
+    X(JZ)      /* if !(r[a] != 0) pc = b, like the IR's 'fcmp one'   */ \
+    X(JGT)     /* if r[a] > r[b] pc = c                              */ \
+    X(TRUNC)   /* r[a] = r[b] rounded towards 0                      */ \
+    X(RET)     /* return int32(r[a])                                 */ \
+    X(IN)      /* scanf("%lf") into r[a]                             */ \
+    X(OUT)     /* printf("%lf\n") r[a]                               */ \
+    X(ANEW)    /* arrays[a] = consts[b] zeroed elements              */ \
+    X(ALOAD_F64)  /* r[a] = arrays[b][r[c]]                          */ \
+    X(ALOAD_F32)  \
+    X(ALOAD_I32)  \
+    X(ALOAD_I8)   \
+    X(ASTORE_F64) /* arrays[a][r[b]] = r[c]                          */ \
+    X(ASTORE_F32) \
+    X(ASTORE_I32) \
+    X(ASTORE_I8)  \
+    X(AMAP)    /* arrays[a] = mapped file strings[b]                 */ \
+    X(AWRITE)  /* arrays[a] written to file strings[b]               */ \
+    X(APRINT)  /* arrays[a] printed, one element per line            */ \
+    X(ASCAN)   /* arrays[a] read, one element per line               */ \
+    X(PCHUNK)  /* r[a] = parallel for chunk size for r[b] to r[c]    */ \
+    X(PLOOP)   /* loops[a] compiled: run its remaining chunks there  */
+
+enum class Op :uint8_t {
+#define X(op) op,
+    RAGE_BYTECODE_OPS(X)
+#undef X
+};
+
+struct Instr {
+    Op op;
+    int32_t a, b, c;
+};
+
+// machine code for a whole function, from the JIT tier
+using Native_Func = int32_t (*)();
+
+// A top level 'parallel for' of the function (nested ones are part of its
+// body). Once the JIT has compiled the function, the interpreter runs the
+// loop's remaining chunks with the body codegen() outlined, so a running
+// frame gets the machine code without on-stack replacement.
+struct Loop {
+    Semantic_Parser::Parallel_For_AST* ast;
+    // registers: next iteration, last one, iterations per chunk, and the
+    // chunks' combined reduction so far
+    int32_t n, last, size, total;
+    char op; // '+' or '*'
+    int32_t end; // where the loop is left, with the reduction in total
+    // what the body's ctx points to, in codegen()'s order: the scalars
+    // (registers), then each array's data and length (array slots)
+    std::vector<int32_t> scalars, arrays;
+
+    uint32_t back_edges {0}; // only the interpreter's thread counts
+    std::atomic<Rage_Parallel_Body> native {nullptr};
+};
+
+struct Function {
+    std::string name;
+    std::vector<Instr> code;
+    std::vector<double> consts;
+    std::vector<std::string> strings;
+    std::vector<Runtime::Elem_Kind> arrays; // kind of each array slot
+    int32_t n_regs {0};
+    std::deque<Loop> loops;
+
+    // tiering: how often the interpreter entered it, and its compiled
+    // version once the JIT has one (then the interpreter calls that instead)
+    std::atomic<uint32_t> calls {0};
+    std::atomic<Native_Func> native {nullptr};
+};
+
+// used by the AST's bytecode() methods to fill a Function
+class Function_Builder
+{
+public:
+    explicit Function_Builder(Function& f) : fn{f} {}
+
+    int32_t new_reg() { return fn.n_regs++; }
+    int32_t constant(double v);
+    int32_t string(const std::string& s);
+
+    size_t emit(Op op, int32_t a = 0, int32_t b = 0, int32_t c = 0);
+    size_t here() const { return fn.code.size(); }
+    Instr& at(size_t i) { return fn.code[i]; }
+
+    int32_t var(const std::string& name) const;
+    int32_t declare_var(const std::string& name);
+    int32_t array(const std::string& name) const;
+    bool has_array(const std::string& name) const { return array_slots.count(name); }
+    int32_t declare_array(const std::string& name, Runtime::Elem_Kind kind);
+    Runtime::Elem_Kind array_kind(int32_t slot) const { return fn.arrays[slot]; }
+    const std::map<std::string, int32_t>& visible_vars() const { return vars; }
+    const std::map<std::string, int32_t>& visible_arrays() const { return array_slots; }
+    int32_t new_loop(Semantic_Parser::Parallel_For_AST& ast);
+    Loop& loop(int32_t i) { return fn.loops[i]; }
+
+    // names declared after begin_scope() are forgotten by end_scope()
+    struct Scope {
+        std::map<std::string, int32_t> vars, arrays;
+        std::set<std::string> shared;
+        bool parallel;
+        int32_t top;
+    };
+    Scope begin_scope() const { return {vars, array_slots, shared, parallel, top}; }
+    void end_scope(Scope s)
+    {
+        vars = std::move(s.vars);
+        array_slots = std::move(s.arrays);
+        shared = std::move(s.shared);
+        parallel = s.parallel;
+        top = s.top;
+    }
+
+    // a 'parallel for' body follows the same rules as codegen(): everything
+    // declared so far is shared by the threads and can't be assigned (or an
+    // array mapped again) until a new declaration hides it.
+    // Its back-edges count for top level loop 'top'.
+    void enter_parallel(int32_t top);
+    bool in_parallel() const { return parallel; }
+    int32_t top_loop() const { return top; }
+    void check_assignable(const std::string& name, const char* where) const;
+
+    // the function uses something the interpreter can't run,
+    // so it has to go to the JIT tier
+    void unsupported(const std::string& what);
+    bool ok() const { return supported; }
+    const std::string& why() const { return reason; }
+
+private:
+    Function& fn;
+    std::map<std::string, int32_t> vars;
+    std::map<std::string, int32_t> array_slots;
+    std::set<std::string> shared;
+    bool parallel {false};
+    int32_t top {-1};
+    bool supported {true};
+    std::string reason;
+};
+
+// nullptr (and why) if the interpreter can't run it
+std::unique_ptr<Function> compile(Semantic_Parser::Function_AST& f, std::string& why);
+
+class Interpreter
+{
+public:
+    // on_hot is called for a function entered 'threshold' times, and for one
+    // whose loop has gone round 'threshold' times (once per loop); it
+    // should compile the function and its loops' bodies
+    Interpreter(uint32_t threshold, std::function<void(Function&)> on_hot)
+        : hot_threshold{threshold}, hot{std::move(on_hot)} {}
+
+    // runs the function's native code if the JIT has finished it, bytecode otherwise
+    int32_t call(Function& f);
+
+private:
+    uint32_t hot_threshold;
+    std::function<void(Function&)> hot;
+
+    int32_t interpret(Function& f);
+};
+
+}
+
+#endif
@@ -0,0 +1,11 @@
+#include <string>
+#include <vector>
+
+#include "server.hpp"
+
+// rage-client: same as 'rage --client' but without linking LLVM,
+// so forwarding a request costs no more than a plain process start
+int main(int argc, char* argv[])
+{
+    return Server::run_client(Server::default_socket_path(), {argv + 1, argv + argc});
+}
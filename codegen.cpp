@@ -1,14 +1,212 @@
 #include "parser.hpp"
 
+#include "llvm/IR/Intrinsics.h"
+
+#include <set>
+
 namespace Semantic_Parser
 {
 
+// while generating a 'parallel for' body: the enclosing function's
+// variables and arrays, which every thread reads, so the body must not
+// assign them (or map an array again)
+static std::set<std::string> shared_vars;
+
+static void check_assignable(const std::string& name, const char* where)
+{
+    if (shared_vars.count(name))
+        ERROR(std::string{std::string{where} + ": " + name + " is shared by the threads of a parallel for,"
+            " only the 'reduce' variable can be assigned"}.c_str());
+}
+
+// declares (once per module) a libc or Rage runtime function
+static llvm::FunctionCallee get_function(const char* name, llvm::Type *ret, std::vector<llvm::Type*> params, bool var_args = false)
+{
+    return TheModule->getOrInsertFunction(name, llvm::FunctionType::get(ret, params, var_args));
+}
+
+void emit_location(const Lexer::Src_Loc& loc)
+{
+    if (!DBuilder)
+        return;
+    llvm::DISubprogram *SP = Builder->GetInsertBlock()->getParent()->getSubprogram();
+    if (SP)
+        Builder->SetCurrentDebugLocation(llvm::DILocation::get(*TheContext, loc.line, loc.col, SP));
+}
+
+static llvm::DIType *debug_type(llvm::Type *ty)
+{
+    if (auto *vec = llvm::dyn_cast<llvm::FixedVectorType>(ty)) {
+        llvm::DIType *elem = debug_type(vec->getElementType());
+        llvm::Metadata *lanes = DBuilder->getOrCreateSubrange(0, vec->getNumElements());
+        return DBuilder->createVectorType(TheModule->getDataLayout().getTypeSizeInBits(vec),
+            TheModule->getDataLayout().getABITypeAlign(vec).value() * 8, elem, DBuilder->getOrCreateArray(lanes));
+    }
+    if (ty->isDoubleTy())
+        return DBuilder->createBasicType("float", 64, llvm::dwarf::DW_ATE_float);
+    if (ty->isFloatTy())
+        return DBuilder->createBasicType("float32", 32, llvm::dwarf::DW_ATE_float);
+    unsigned bits = ty->getIntegerBitWidth();
+    return DBuilder->createBasicType("int" + std::to_string(bits), bits, llvm::dwarf::DW_ATE_signed);
+}
+
+// lets the debugger (and profilers) see 'alloca' as the Rage variable 'name'
+static void declare_variable(llvm::AllocaInst *alloca, const std::string& name, llvm::DIType *ty, const Lexer::Src_Loc& loc)
+{
+    llvm::DISubprogram *SP = alloca->getFunction()->getSubprogram();
+    if (!SP)
+        return;
+    llvm::DILocalVariable *var = DBuilder->createAutoVariable(SP, name, SP->getFile(), loc.line, ty, true);
+    DBuilder->insertDeclare(alloca, var, DBuilder->createExpression(),
+        llvm::DILocation::get(*TheContext, loc.line, loc.col, SP), Builder->GetInsertBlock());
+}
+
+static llvm::Type *i8ptr_type()
+{
+    return llvm::PointerType::get(llvm::Type::getInt8Ty(*TheContext), 0);
+}
+
+Runtime::Elem_Kind array_elem_kind(const std::string& type)
+{
+    if ("float" == type)
+        return Runtime::Elem_Kind::F64;
+    if ("float32" == type)
+        return Runtime::Elem_Kind::F32;
+    if ("int32" == type)
+        return Runtime::Elem_Kind::I32;
+    if ("int8" == type)
+        return Runtime::Elem_Kind::I8;
+    ERROR(std::string{"invalid array element type " + type}.c_str());
+}
+
+// element type of 'type[N]' arrays
+static llvm::Type *array_elem_type(const std::string& type, Runtime::Elem_Kind& kind)
+{
+    kind = array_elem_kind(type);
+    switch (kind) {
+    case Runtime::Elem_Kind::F64: return llvm::Type::getDoubleTy(*TheContext);
+    case Runtime::Elem_Kind::F32: return llvm::Type::getFloatTy(*TheContext);
+    case Runtime::Elem_Kind::I32: return llvm::Type::getInt32Ty(*TheContext);
+    case Runtime::Elem_Kind::I8:  return llvm::Type::getInt8Ty(*TheContext);
+    }
+    ERROR(std::string{"invalid array element type " + type}.c_str());
+}
+
+bool is_vector_type(const std::string& type)
+{
+    return 0 != vector_lanes(type);
+}
+
+unsigned vector_lanes(const std::string& type)
+{
+    if ("float4" == type)
+        return 4;
+    if ("float8" == type || "int32x8" == type)
+        return 8;
+    return 0;
+}
+
+llvm::Type *value_type(const std::string& type)
+{
+    if ("float4" == type)
+        return llvm::FixedVectorType::get(llvm::Type::getDoubleTy(*TheContext), 4);
+    if ("float8" == type)
+        return llvm::FixedVectorType::get(llvm::Type::getDoubleTy(*TheContext), 8);
+    if ("int32x8" == type)
+        return llvm::FixedVectorType::get(llvm::Type::getInt32Ty(*TheContext), 8);
+    return llvm::Type::getDoubleTy(*TheContext);
+}
+
+// vectors can't be used where only a float makes sense
+static llvm::Value *scalar(llvm::Value *v, const char* where)
+{
+    if (v->getType()->isVectorTy())
+        ERROR(std::string{std::string{where} + ": expected a float, got a vector"}.c_str());
+    return v;
+}
+
+// v as a value of type ty: a float is splat into every lane of a vector
+static llvm::Value *convert_to(llvm::Value *v, llvm::Type *ty, const char* where)
+{
+    if (v->getType() == ty)
+        return v;
+    auto *vec = llvm::dyn_cast<llvm::FixedVectorType>(ty);
+    if (!vec || v->getType()->isVectorTy())
+        ERROR(std::string{std::string{where} + ": vector types don't match"}.c_str());
+    if (vec->getElementType()->isIntegerTy())
+        v = Builder->CreateFPToSI(v, vec->getElementType(), "to_int");
+    return Builder->CreateVectorSplat(vec->getNumElements(), v, "splat");
+}
+
+// which lane 'index' picks out of 'lanes': the parser checks constant
+// indexes, a computed one wraps around (the lane counts are powers of 2)
+// rather than reading or writing past the vector
+static llvm::Value *lane_index(Expr_AST& index, unsigned lanes)
+{
+    llvm::Type *i32 = llvm::Type::getInt32Ty(*TheContext);
+    if (auto *num = dynamic_cast<Number_Expr_AST*>(&index))
+        return llvm::ConstantInt::get(i32, static_cast<uint64_t>(num->value()));
+    llvm::Value *v = scalar(index.codegen(), "lane index");
+    // saturating, so a NaN or huge index is still a number
+    llvm::Value *i = Builder->CreateIntrinsic(llvm::Intrinsic::fptosi_sat, {i32, v->getType()}, {v}, nullptr, "lane");
+    return Builder->CreateAnd(i, lanes - 1, "lane");
+}
+
+// lane 'index' of a vector, as a float
+static llvm::Value *vector_lane(llvm::Value *vec, Expr_AST& index, const std::string& name)
+{
+    llvm::Value *i = lane_index(index, llvm::cast<llvm::FixedVectorType>(vec->getType())->getNumElements());
+    llvm::Value *lane = Builder->CreateExtractElement(vec, i, name + "_lane");
+    if (lane->getType()->isIntegerTy())
+        return Builder->CreateSIToFP(lane, llvm::Type::getDoubleTy(*TheContext), "to_double");
+    return lane;
+}
+
+static Array_Var& lookup_array(const std::string& name)
+{
+    auto it = NamedArrays.find(name);
+    if (NamedArrays.end() == it)
+        ERROR(std::string{"array " + name + " not recognized"}.c_str());
+    return it->second;
+}
+
+// L / R on int32 lanes without sdiv's undefined cases: a lane divided by 0
+// gives 0, and INT_MIN / -1 wraps to INT_MIN
+static llvm::Value *int_div(llvm::Value *L, llvm::Value *R)
+{
+    llvm::Type *ty = R->getType();
+    llvm::Value *zero = llvm::Constant::getNullValue(ty);
+    llvm::Value *by_zero = Builder->CreateICmpEQ(R, zero, "by_zero");
+    llvm::Value *overflow = Builder->CreateAnd(
+        Builder->CreateICmpEQ(L, llvm::ConstantInt::get(ty, llvm::APInt::getSignedMinValue(32)), "int_min"),
+        Builder->CreateICmpEQ(R, llvm::Constant::getAllOnesValue(ty), "minus_one"), "overflow");
+    llvm::Value *safe = Builder->CreateSelect(Builder->CreateOr(by_zero, overflow), llvm::ConstantInt::get(ty, 1), R, "divisor");
+    return Builder->CreateSelect(by_zero, zero, Builder->CreateSDiv(L, safe), "divtmp_name");
+}
+
 llvm::Value* Binary_Expr_AST::codegen()
 {
     llvm::Value *L = LHS->codegen();
     llvm::Value *R = RHS->codegen();
     if (!L || !R) return nullptr;
 
+    emit_location(loc);
+
+    // lane-wise, a float on either side is splat to the other's width
+    if (L->getType()->isVectorTy() || R->getType()->isVectorTy()) {
+        llvm::Type *ty = L->getType()->isVectorTy() ? L->getType() : R->getType();
+        L = convert_to(L, ty, "BinaryExprAST codegen()");
+        R = convert_to(R, ty, "BinaryExprAST codegen()");
+        if (ty->isIntOrIntVectorTy()) {
+            switch (op) {
+            case Math_Op::PLUS:  return Builder->CreateAdd(L, R, "addtmp_name");
+            case Math_Op::MINUS: return Builder->CreateSub(L, R, "subtmp_name");
+            case Math_Op::MULT:  return Builder->CreateMul(L, R, "multmp_name");
+            case Math_Op::DIV:   return int_div(L, R);
+            }
+        }
+    }
+
     switch (op) {
         case Math_Op::PLUS:
             return Builder->CreateFAdd(L, R, "addtmp_name");
@@ -33,9 +231,77 @@ llvm::Value* Var_Expr_AST::codegen()
     llvm::AllocaInst *A = NamedValues[name];
     if (!A)
         ERROR("VarExprAST codegen(): variable not defined earlier");
+    emit_location(loc);
     return Builder->CreateLoad(A->getAllocatedType(), A, name.c_str());
 }
 
+llvm::Value* Array_Elem_Expr_AST::element_ptr(const std::string& name, Expr_AST& index, Array_Var& arr)
+{
+    llvm::Value *v_index = index.codegen();
+    if (!v_index)
+        ERROR("In Array_Elem_Expr_AST::codegen(): invalid index.");
+    v_index = Builder->CreateFPToSI(scalar(v_index, "array index"), llvm::Type::getInt64Ty(*TheContext), "index");
+
+    llvm::Value *data = Builder->CreateLoad(arr.data->getAllocatedType(), arr.data, name + "_data");
+    return Builder->CreateGEP(arr.elem_ty, data, v_index, name + "_elem");
+}
+
+llvm::Value* Array_Elem_Expr_AST::codegen()
+{
+    // v[i] on a vector variable reads one lane
+    llvm::AllocaInst *vec = NamedValues[name];
+    if (!NamedArrays.count(name) && vec && vec->getAllocatedType()->isVectorTy()) {
+        emit_location(loc);
+        llvm::Value *v = Builder->CreateLoad(vec->getAllocatedType(), vec, name.c_str());
+        return vector_lane(v, *index, name);
+    }
+
+    Array_Var& arr = lookup_array(name);
+    llvm::Value *ptr = element_ptr(name, *index, arr);
+    emit_location(loc);
+    llvm::Value *elem = Builder->CreateLoad(arr.elem_ty, ptr, name.c_str());
+
+    // every value is a double once it is loaded
+    if (arr.elem_ty->isFloatTy())
+        return Builder->CreateFPExt(elem, llvm::Type::getDoubleTy(*TheContext), "to_double");
+    if (arr.elem_ty->isIntegerTy())
+        return Builder->CreateSIToFP(elem, llvm::Type::getDoubleTy(*TheContext), "to_double");
+    return elem;
+}
+
+llvm::Value* Reduce_Expr_AST::codegen()
+{
+    llvm::Value *v = arg->codegen();
+    if (!v || !v->getType()->isVectorTy())
+        ERROR(std::string{"In Reduce_Expr_AST::codegen(): " + func + " expects a vector"}.c_str());
+    emit_location(loc);
+
+    if (v->getType()->isIntOrIntVectorTy()) {
+        llvm::Value *r;
+        if ("reduce_add" == func)
+            r = Builder->CreateAddReduce(v);
+        else if ("reduce_mul" == func)
+            r = Builder->CreateMulReduce(v);
+        else if ("reduce_min" == func)
+            r = Builder->CreateIntMinReduce(v, true);
+        else
+            r = Builder->CreateIntMaxReduce(v, true);
+        return Builder->CreateSIToFP(r, llvm::Type::getDoubleTy(*TheContext), "to_double");
+    }
+
+    if ("reduce_min" == func)
+        return Builder->CreateFPMinReduce(v);
+    if ("reduce_max" == func)
+        return Builder->CreateFPMaxReduce(v);
+
+    llvm::CallInst *r = "reduce_add" == func
+        ? Builder->CreateFAddReduce(llvm::ConstantFP::get(*TheContext, llvm::APFloat(-0.0)), v)
+        : Builder->CreateFMulReduce(llvm::ConstantFP::get(*TheContext, llvm::APFloat(1.0)), v);
+    // horizontal: the lanes may be combined pairwise instead of strictly in order
+    r->setHasAllowReassoc(true);
+    return r;
+}
+
 llvm::Value* Var_Declaration_AST::codegen()
 {
     //!
@@ -46,9 +312,14 @@ llvm::Value* Var_Declaration_AST::codegen()
         ERROR("In VarDeclaration_AST::codegen(): invalid expression.");
 
     llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
-    llvm::AllocaInst *alloca_space = Var_Declaration_AST::create_alloca_in_entryblock(TheFunction, var_name);
+    llvm::AllocaInst *alloca_space = Var_Declaration_AST::create_alloca_in_entryblock(TheFunction, var_name, value_type(data_type));
+    emit_location(loc);
+    if (DBuilder)
+        declare_variable(alloca_space, var_name, debug_type(alloca_space->getAllocatedType()), loc);
+    v_expr = convert_to(v_expr, alloca_space->getAllocatedType(), "In VarDeclaration_AST::codegen()");
     Builder->CreateStore(v_expr, alloca_space);
     NamedValues[var_name] = alloca_space;
+    shared_vars.erase(var_name); // a new variable that hides the shared one
     
     return v_expr;
 }
@@ -57,12 +328,76 @@ llvm::Value* Var_Assignment_AST::codegen()
 {
     llvm::AllocaInst *aloc = NamedValues[id];
     if (!aloc) ERROR(std::string{"In VarAssignment_AST::codegen(): var name " + id + " not recognized"}.c_str());
+    check_assignable(id, "In VarAssignment_AST::codegen()");
     llvm::Value *val {std::move(expr->codegen())};
     if (!val) ERROR("In VarAssignment_AST::codegen(): invalid expression");
+    emit_location(loc);
+    val = convert_to(val, aloc->getAllocatedType(), "In VarAssignment_AST::codegen()");
     Builder->CreateStore(val, aloc);
     return val;
 }
 
+llvm::Value* Array_Declaration_AST::codegen()
+{
+    Array_Var arr;
+    arr.elem_ty = array_elem_type(data_type, arr.kind);
+
+    llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
+    llvm::IRBuilder<> TmpB(&TheFunction->getEntryBlock(), TheFunction->getEntryBlock().begin());
+    arr.data = TmpB.CreateAlloca(llvm::PointerType::get(arr.elem_ty, 0), nullptr, var_name + "_data");
+    arr.len = TmpB.CreateAlloca(llvm::Type::getInt64Ty(*TheContext), nullptr, var_name + "_len");
+
+    emit_location(loc);
+    if (DBuilder)
+        declare_variable(arr.data, var_name, DBuilder->createPointerType(debug_type(arr.elem_ty), 64), loc);
+
+    llvm::Type *i64 = llvm::Type::getInt64Ty(*TheContext);
+    llvm::FunctionCallee alloc = get_function("rage_array_alloc", i8ptr_type(), {i64, i64});
+    llvm::Value *n = llvm::ConstantInt::get(i64, size);
+    llvm::Value *elem_size = llvm::ConstantInt::get(i64, TheModule->getDataLayout().getTypeAllocSize(arr.elem_ty));
+    llvm::Value *data = Builder->CreateCall(alloc, {n, elem_size}, var_name);
+
+    Builder->CreateStore(Builder->CreateBitCast(data, arr.data->getAllocatedType()), arr.data);
+    Builder->CreateStore(n, arr.len);
+    NamedArrays[var_name] = arr;
+    shared_vars.erase(var_name); // a new array that hides the shared one
+
+    return data;
+}
+
+llvm::Value* Array_Assignment_AST::codegen()
+{
+    // v[i] = x on a vector variable replaces one lane
+    llvm::AllocaInst *vec = NamedValues[id];
+    if (!NamedArrays.count(id) && vec && vec->getAllocatedType()->isVectorTy()) {
+        auto *vec_ty = llvm::cast<llvm::FixedVectorType>(vec->getAllocatedType());
+        llvm::Value *val = scalar(expr->codegen(), "In Array_Assignment_AST::codegen()");
+        llvm::Value *i = lane_index(*index, vec_ty->getNumElements());
+        emit_location(loc);
+        if (vec_ty->getElementType()->isIntegerTy())
+            val = Builder->CreateFPToSI(val, vec_ty->getElementType(), "to_int");
+        llvm::Value *v = Builder->CreateLoad(vec_ty, vec, id.c_str());
+        Builder->CreateStore(Builder->CreateInsertElement(v, val, i, id + "_lane"), vec);
+        return val;
+    }
+
+    Array_Var& arr = lookup_array(id);
+    llvm::Value *val = expr->codegen();
+    if (!val) ERROR("In Array_Assignment_AST::codegen(): invalid expression");
+    scalar(val, "In Array_Assignment_AST::codegen()");
+    emit_location(loc);
+
+    if (arr.elem_ty->isFloatTy())
+        val = Builder->CreateFPTrunc(val, arr.elem_ty, "to_float32");
+    else if (arr.elem_ty->isIntegerTy())
+        val = Builder->CreateFPToSI(val, arr.elem_ty, "to_int");
+
+    llvm::Value *ptr = Array_Elem_Expr_AST::element_ptr(id, *index, arr);
+    emit_location(loc);
+    Builder->CreateStore(val, ptr);
+    return val;
+}
+
 //TODO for now it converts value to int32
 llvm::Value* Return_AST::codegen()
 {
@@ -70,7 +405,9 @@ llvm::Value* Return_AST::codegen()
     //return Builder->CreateRet(as_int);
     ret_val.yes = true;
     ret_val.data_type = Lexer::Token_type::FLOAT; //TODO assume float for now
-    return ret_val.val = expr->codegen();
+    ret_val.val = scalar(expr->codegen(), "In Return_AST::codegen()");
+    emit_location(loc); // for the 'ret' the caller emits
+    return ret_val.val;
     
 }
 
@@ -80,6 +417,8 @@ llvm::Value* If_Else_AST::codegen()
     llvm::Value *v_cond = cond->codegen();
     if (!v_cond)
         ERROR("In IfElse_AST::codegen(): condition is NULL");
+    scalar(v_cond, "In IfElse_AST::codegen()");
+    emit_location(loc);
     // convert condition's value from float to bool
     v_cond = Builder->CreateFCmpONE(v_cond, llvm::ConstantFP::get(*TheContext, llvm::APFloat(0.0)), "ifcond");
 
@@ -157,12 +496,43 @@ llvm::Value* If_Else_AST::codegen()
     return merge_bb; // return something...
 }
 
-llvm::Value* Function_AST::codegen() 
+// creates the function and its entry block (and with -g its DISubprogram)
+// and points the Builder at it
+static llvm::Function *begin_function(const std::string& name, llvm::FunctionType *funcType,
+    llvm::Function::LinkageTypes linkage, const Lexer::Src_Loc& loc)
 {
-    llvm::FunctionType *funcType = llvm::FunctionType::get(llvm::Type::getInt32Ty(*TheContext), false); //TODO assume int32: 
-    llvm::Function *func = llvm::Function::Create(funcType, llvm::Function::ExternalLinkage, name, TheModule.get());
+    llvm::Function *func = llvm::Function::Create(funcType, linkage, name, TheModule.get());
     llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*TheContext, "entry", func);
     Builder->SetInsertPoint(entryBlock);
+
+    if (DBuilder) {
+        llvm::DIFile *file = TheCU->getFile();
+        std::vector<llvm::Metadata*> types {debug_type(funcType->getReturnType())};
+        for (llvm::Type *param : funcType->params())
+            types.push_back(param->isPointerTy() ? DBuilder->createNullPtrType() : debug_type(param));
+        llvm::DISubroutineType *sp_type = DBuilder->createSubroutineType(DBuilder->getOrCreateTypeArray(types));
+        llvm::DISubprogram *SP = DBuilder->createFunction(file, name, llvm::StringRef(), file, loc.line, sp_type, loc.line,
+            llvm::DINode::FlagPrototyped, llvm::DISubprogram::SPFlagDefinition
+                | (llvm::Function::InternalLinkage == linkage ? llvm::DISubprogram::SPFlagLocalToUnit : llvm::DISubprogram::SPFlagZero));
+        func->setSubprogram(SP);
+    }
+    // don't let the previous function's location leak in
+    Builder->SetCurrentDebugLocation(llvm::DebugLoc());
+    return func;
+}
+
+static void end_function(llvm::Function *func)
+{
+    if (llvm::DISubprogram *SP = func->getSubprogram())
+        DBuilder->finalizeSubprogram(SP);
+
+    llvm::verifyFunction(*func);
+}
+
+llvm::Value* Function_AST::codegen() 
+{
+    llvm::FunctionType *funcType = llvm::FunctionType::get(llvm::Type::getInt32Ty(*TheContext), false); //TODO assume int32: 
+    llvm::Function *func = begin_function(name, funcType, llvm::Function::ExternalLinkage, loc);
     
     for (auto& s : body)
         s->codegen();
@@ -172,25 +542,245 @@ llvm::Value* Function_AST::codegen()
         llvm::Value *v_int = Builder->CreateFPToSI(ret_val.val, llvm::Type::getInt32Ty(*TheContext), "float_to_i32");
         Builder->CreateRet(v_int);
     }
-    
-    llvm::verifyFunction(*func);
+
+    end_function(func);
     return func;
 }
 
+// The body becomes 'double <function>.parallel(i64 lo, i64 hi, i8* ctx)',
+// which runs the iterations [lo, hi) and returns their part of the reduction.
+// ctx holds a pointer to every variable of the enclosing function (two for
+// arrays: data and length); the body works on copies of the scalars and
+// on the arrays' elements themselves. rage_parallel_for splits the range
+// into chunks for the thread pool and combines the parts.
+llvm::Value* Parallel_For_AST::codegen()
+{
+    llvm::Type *f64 = llvm::Type::getDoubleTy(*TheContext);
+    llvm::Type *i64 = llvm::Type::getInt64Ty(*TheContext);
+    llvm::Type *i32 = llvm::Type::getInt32Ty(*TheContext);
+    llvm::Function *parent = Builder->GetInsertBlock()->getParent();
+
+    llvm::Value *lo = scalar(from->codegen(), "In Parallel_For_AST::codegen()");
+    llvm::Value *hi = scalar(to->codegen(), "In Parallel_For_AST::codegen()");
+    emit_location(loc);
+    lo = Builder->CreateFPToSI(lo, i64, "lo");
+    hi = Builder->CreateAdd(Builder->CreateFPToSI(hi, i64), llvm::ConstantInt::get(i64, 1), "hi"); // 'to' is included
+
+    llvm::AllocaInst *outer_acc = nullptr;
+    if (reduce_op) {
+        outer_acc = NamedValues[reduce_var];
+        if (!outer_acc || outer_acc->getFunction() != parent)
+            ERROR(std::string{"In Parallel_For_AST::codegen(): reduce variable " + reduce_var + " not recognized"}.c_str());
+        if (!outer_acc->getAllocatedType()->isDoubleTy())
+            ERROR("In Parallel_For_AST::codegen(): the reduce variable must be a float");
+        check_assignable(reduce_var, "In Parallel_For_AST::codegen()");
+    }
+
+    // NamedValues/NamedArrays may still hold earlier functions' variables
+    std::vector<std::pair<std::string, llvm::AllocaInst*>> scalars;
+    for (const auto& [name, a] : NamedValues)
+        if (a && a->getFunction() == parent && name != reduce_var && name != var)
+            scalars.push_back({name, a});
+    std::vector<std::pair<std::string, Array_Var>> arrays;
+    for (const auto& [name, arr] : NamedArrays)
+        if (arr.data->getFunction() == parent)
+            arrays.push_back({name, arr});
+
+    //* Step 1: the outlined body
+
+    auto saved_values = NamedValues;
+    auto saved_arrays = NamedArrays;
+    auto saved_shared = shared_vars;
+    llvm::BasicBlock *saved_block = Builder->GetInsertBlock();
+    llvm::DebugLoc saved_loc = Builder->getCurrentDebugLocation();
+    NamedValues.clear();
+    NamedArrays.clear();
+
+    llvm::FunctionType *body_ty = llvm::FunctionType::get(f64, {i64, i64, i8ptr_type()}, false);
+    llvm::Function *body_fn = begin_function(parent->getName().str() + ".parallel", body_ty,
+        llvm::Function::InternalLinkage, loc);
+    body_name = body_fn->getName().str();
+    llvm::Value *chunk_lo = body_fn->getArg(0);
+    llvm::Value *chunk_hi = body_fn->getArg(1);
+    llvm::Value *ctx_ptrs = Builder->CreateBitCast(body_fn->getArg(2), llvm::PointerType::get(i8ptr_type(), 0), "ctx");
+
+    unsigned k = 0;
+    auto captured = [&](llvm::Type *ty, const std::string& name) {
+        llvm::Value *p = Builder->CreateLoad(i8ptr_type(), Builder->CreateConstInBoundsGEP1_32(i8ptr_type(), ctx_ptrs, k++), name + "_ptr");
+        return Builder->CreateBitCast(p, llvm::PointerType::get(ty, 0));
+    };
+    for (const auto& [name, outer] : scalars) {
+        llvm::Type *ty = outer->getAllocatedType();
+        llvm::AllocaInst *copy = Var_Declaration_AST::create_alloca_in_entryblock(body_fn, name, ty);
+        Builder->CreateStore(Builder->CreateLoad(ty, captured(ty, name), name), copy);
+        NamedValues[name] = copy;
+        shared_vars.insert(name);
+    }
+    for (const auto& [name, outer] : arrays) {
+        Array_Var arr = outer;
+        llvm::IRBuilder<> TmpB(&body_fn->getEntryBlock(), body_fn->getEntryBlock().begin());
+        arr.data = TmpB.CreateAlloca(outer.data->getAllocatedType(), nullptr, name + "_data");
+        arr.len = TmpB.CreateAlloca(i64, nullptr, name + "_len");
+        llvm::Type *data_ty = outer.data->getAllocatedType();
+        Builder->CreateStore(Builder->CreateLoad(data_ty, captured(data_ty, name)), arr.data);
+        Builder->CreateStore(Builder->CreateLoad(i64, captured(i64, name)), arr.len);
+        NamedArrays[name] = arr;
+        shared_vars.insert(name);
+    }
+
+    // every chunk reduces into its own accumulator
+    llvm::Constant *identity = llvm::ConstantFP::get(f64, '*' == reduce_op ? 1.0 : 0.0);
+    llvm::AllocaInst *acc = Var_Declaration_AST::create_alloca_in_entryblock(body_fn, reduce_op ? reduce_var : "acc");
+    Builder->CreateStore(identity, acc);
+    if (reduce_op)
+        NamedValues[reduce_var] = acc;
+
+    llvm::AllocaInst *counter = Var_Declaration_AST::create_alloca_in_entryblock(body_fn, var + "_n", i64);
+    Builder->CreateStore(chunk_lo, counter);
+    llvm::AllocaInst *i_var = Var_Declaration_AST::create_alloca_in_entryblock(body_fn, var);
+    NamedValues[var] = i_var;
+    shared_vars.erase(var);
+    if (DBuilder)
+        declare_variable(i_var, var, debug_type(f64), loc);
+
+    llvm::BasicBlock *cond_bb = llvm::BasicBlock::Create(*TheContext, "loop_cond", body_fn);
+    llvm::BasicBlock *body_bb = llvm::BasicBlock::Create(*TheContext, "loop_body", body_fn);
+    llvm::BasicBlock *end_bb = llvm::BasicBlock::Create(*TheContext, "loop_end", body_fn);
+    Builder->CreateBr(cond_bb);
+
+    Builder->SetInsertPoint(cond_bb);
+    llvm::Value *n = Builder->CreateLoad(i64, counter, var + "_n");
+    Builder->CreateCondBr(Builder->CreateICmpSLT(n, chunk_hi, "loopcond"), body_bb, end_bb);
+
+    Builder->SetInsertPoint(body_bb);
+    Builder->CreateStore(Builder->CreateSIToFP(n, f64, var), i_var);
+    for (auto& s : body)
+        s->codegen();
+    emit_location(loc);
+    Builder->CreateStore(Builder->CreateAdd(Builder->CreateLoad(i64, counter), llvm::ConstantInt::get(i64, 1), "next"), counter);
+    Builder->CreateBr(cond_bb);
+
+    Builder->SetInsertPoint(end_bb);
+    Builder->CreateRet(Builder->CreateLoad(f64, acc, "partial"));
+    end_function(body_fn);
+
+    NamedValues = std::move(saved_values);
+    NamedArrays = std::move(saved_arrays);
+    shared_vars = std::move(saved_shared);
+    Builder->SetInsertPoint(saved_block);
+    Builder->SetCurrentDebugLocation(saved_loc);
+
+    //* Step 2: the call, in the enclosing function
+
+    llvm::Type *i8ptr = i8ptr_type();
+    llvm::ArrayType *ctx_ty = llvm::ArrayType::get(i8ptr, std::max<size_t>(k, 1));
+    llvm::IRBuilder<> TmpB(&parent->getEntryBlock(), parent->getEntryBlock().begin());
+    llvm::AllocaInst *ctx = TmpB.CreateAlloca(ctx_ty, nullptr, "ctx");
+
+    k = 0;
+    auto capture = [&](llvm::Value *ptr) {
+        Builder->CreateStore(Builder->CreateBitCast(ptr, i8ptr), Builder->CreateConstInBoundsGEP2_32(ctx_ty, ctx, 0, k++));
+    };
+    for (const auto& s : scalars)
+        capture(s.second);
+    for (const auto& a : arrays) {
+        capture(a.second.data);
+        capture(a.second.len);
+    }
+
+    llvm::FunctionCallee parallel_for = get_function("rage_parallel_for", f64,
+        {i64, i64, f64, i32, llvm::PointerType::get(body_ty, 0), i8ptr});
+    llvm::Value *result = Builder->CreateCall(parallel_for, {lo, hi, identity,
+        llvm::ConstantInt::get(i32, reduce_op ? reduce_op : '+'), body_fn, Builder->CreateBitCast(ctx, i8ptr)}, "parallel");
+
+    if (reduce_op) {
+        llvm::Value *s = Builder->CreateLoad(f64, outer_acc, reduce_var);
+        s = '*' == reduce_op ? Builder->CreateFMul(s, result, "reduce") : Builder->CreateFAdd(s, result, "reduce");
+        Builder->CreateStore(s, outer_acc);
+    }
+    return result;
+}
+
+// whole arrays go through the runtime: from/to a binary file
+// in one mmap/write, or as text one element per line
+llvm::Value* Stream_AST::codegen_array()
+{
+    Array_Var& arr = lookup_array(id);
+    llvm::Type *i64 = llvm::Type::getInt64Ty(*TheContext);
+    llvm::Type *i32 = llvm::Type::getInt32Ty(*TheContext);
+    llvm::Type *void_ty = llvm::Type::getVoidTy(*TheContext);
+    uint64_t elem_size = TheModule->getDataLayout().getTypeAllocSize(arr.elem_ty);
+    bool in = internal_func_name == "scanf";
+
+    if (in && !file.empty()) {
+        check_assignable(id, "In Stream_AST::codegen()");
+        llvm::FunctionCallee map = get_function("rage_array_map", i8ptr_type(),
+            {i8ptr_type(), i64, llvm::PointerType::get(i64, 0), i8ptr_type()});
+        llvm::Value *old = Builder->CreateBitCast(
+            Builder->CreateLoad(arr.data->getAllocatedType(), arr.data, id + "_data"), i8ptr_type());
+        llvm::Value *data = Builder->CreateCall(map,
+            {Builder->CreateGlobalStringPtr(file), llvm::ConstantInt::get(i64, elem_size), arr.len, old}, id);
+        Builder->CreateStore(Builder->CreateBitCast(data, arr.data->getAllocatedType()), arr.data);
+        return data;
+    }
+
+    llvm::Value *data = Builder->CreateBitCast(
+        Builder->CreateLoad(arr.data->getAllocatedType(), arr.data, id + "_data"), i8ptr_type());
+    llvm::Value *len = Builder->CreateLoad(i64, arr.len, id + "_len");
+
+    if (!file.empty()) {
+        llvm::FunctionCallee write = get_function("rage_array_write", void_ty, {i8ptr_type(), i8ptr_type(), i64});
+        llvm::Value *bytes = Builder->CreateMul(len, llvm::ConstantInt::get(i64, elem_size), "bytes");
+        return Builder->CreateCall(write, {Builder->CreateGlobalStringPtr(file), data, bytes});
+    }
+
+    llvm::FunctionCallee text = get_function(in ? "rage_array_scan" : "rage_array_print", void_ty, {i8ptr_type(), i64, i32});
+    return Builder->CreateCall(text, {data, len, llvm::ConstantInt::get(i32, static_cast<int32_t>(arr.kind))});
+}
+
+// vectors: one lane per line, like arrays without a file
+llvm::Value* Stream_AST::codegen_vector(llvm::AllocaInst *vec)
+{
+    auto *ty = llvm::cast<llvm::FixedVectorType>(vec->getAllocatedType());
+    bool int_lanes = ty->getElementType()->isIntegerTy();
+    llvm::FunctionCallee stream_func = get_function(internal_func_name.c_str(),
+        llvm::Type::getInt32Ty(*TheContext), {i8ptr_type()}, true);
+    llvm::Value *v = Builder->CreateLoad(ty, vec, id.c_str());
+
+    if (internal_func_name == "printf") {
+        llvm::Constant *formatStr = Builder->CreateGlobalStringPtr(int_lanes ? "%d\n" : "%lf\n");
+        for (unsigned i = 0; i < ty->getNumElements(); ++i)
+            Builder->CreateCall(stream_func, {formatStr, Builder->CreateExtractElement(v, i)}, internal_func_name);
+        return v;
+    }
+
+    // every lane is read as a float through a temporary
+    llvm::AllocaInst *tmp = Var_Declaration_AST::create_alloca_in_entryblock(
+        Builder->GetInsertBlock()->getParent(), id + "_in");
+    llvm::Constant *formatStr = Builder->CreateGlobalStringPtr("%lf");
+    for (unsigned i = 0; i < ty->getNumElements(); ++i) {
+        Builder->CreateCall(stream_func, {formatStr, tmp}, internal_func_name);
+        llvm::Value *lane = Builder->CreateLoad(tmp->getAllocatedType(), tmp, id + "_lane");
+        if (int_lanes)
+            lane = Builder->CreateFPToSI(lane, ty->getElementType(), "to_int");
+        v = Builder->CreateInsertElement(v, lane, i);
+    }
+    Builder->CreateStore(v, vec);
+    return v;
+}
+
 llvm::Value* Stream_AST::codegen()
-{    
-    llvm::FunctionType *stream_func_type = llvm::FunctionType::get(
-        llvm::Type::getInt32Ty(*TheContext),
-        llvm::PointerType::get(llvm::Type::getInt8Ty(*TheContext), 0),
-        true
-    );
-    
-    llvm::Function *stream_func = llvm::Function::Create(
-        stream_func_type,
-        llvm::Function::ExternalLinkage,
-        internal_func_name,
-        TheModule.get()
-    );
+{
+    emit_location(loc);
+    if (!file.empty() || NamedArrays.count(id))
+        return codegen_array();
+    if (internal_func_name == "scanf")
+        check_assignable(id, "In Stream_AST::codegen()");
+    if (NamedValues[id] && NamedValues[id]->getAllocatedType()->isVectorTy())
+        return codegen_vector(NamedValues[id]);
+
+    llvm::FunctionCallee stream_func = get_function(internal_func_name.c_str(),
+        llvm::Type::getInt32Ty(*TheContext), {i8ptr_type()}, true);
 
     llvm::AllocaInst *aloc = NamedValues[id];
     llvm::LoadInst *var = nullptr;
@@ -210,9 +800,7 @@ llvm::Value* Stream_AST::codegen()
         stream_func_args.push_back(var);
     }
     
-    Builder->CreateCall(stream_func, stream_func_args, internal_func_name);
-
-    return stream_func;
+    return Builder->CreateCall(stream_func, stream_func_args, internal_func_name);
 }
 
 
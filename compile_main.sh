@@ -1 +1,3 @@
-clang++ -g -O3 -Wall -pedantic lexer.cpp parser.cpp codegen.cpp main.cpp `llvm-config --cxxflags --ldflags --system-libs --libs core` -o rage
\ No newline at end of file
+clang++ -g -O3 -Wall -pedantic -pthread -rdynamic lexer.cpp parser.cpp codegen.cpp bytecode.cpp jit.cpp runtime.cpp server.cpp pipeline.cpp autotune.cpp main.cpp `llvm-config --cxxflags --ldflags --system-libs --libs core bitwriter passes native orcjit` -o rage
+clang++ -O3 -Wall -pedantic server.cpp client_main.cpp -o rage-client
+clang++ -O3 -Wall -pedantic -pthread -c runtime.cpp -o rage_runtime.o
\ No newline at end of file
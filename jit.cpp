@@ -0,0 +1,112 @@
+#include "jit.hpp"
+#include "parser.hpp"
+
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/IR/LLVMRemarkStreamer.h"
+#include "llvm/Remarks/RemarkStreamer.h"
+#include "llvm/Support/TargetSelect.h"
+
+namespace Jit
+{
+
+[[noreturn]] static void fail(const std::string& what, llvm::Error err)
+{
+    ERROR(std::string{"JIT: " + what + ": " + llvm::toString(std::move(err))}.c_str());
+}
+
+Engine::Engine(const Pipeline::Options& o, const Pipeline::Remarks& r) : opts{o}, remarks{r}
+{
+    Pipeline::enable_statistics(remarks);
+
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+
+    auto j = llvm::orc::LLJITBuilder().create();
+    if (!j)
+        fail("cannot create", j.takeError());
+    jit = std::move(*j);
+
+    // libc and the Rage runtime (rage is linked with -rdynamic) come from the process itself
+    auto gen = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(jit->getDataLayout().getGlobalPrefix());
+    if (!gen)
+        fail("cannot search the process", gen.takeError());
+    jit->getMainJITDylib().addGenerator(std::move(*gen));
+}
+
+Engine::~Engine()
+{
+    std::vector<std::thread> ws;
+    {
+        std::lock_guard<std::mutex> lock {mtx};
+        ws.swap(workers);
+    }
+    for (auto& w : ws)
+        w.join();
+}
+
+void Engine::add(const std::string& name, std::unique_ptr<llvm::LLVMContext> ctx, std::unique_ptr<llvm::Module> M)
+{
+    std::lock_guard<std::mutex> lock {mtx};
+    pending[name] = Pending_IR{std::move(ctx), std::move(M)};
+}
+
+bool Engine::has(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock {mtx};
+    return pending.count(name);
+}
+
+Bytecode::Native_Func Engine::compile(const std::string& name)
+{
+    Pending_IR ir;
+    {
+        std::lock_guard<std::mutex> lock {mtx};
+        auto it = pending.find(name);
+        if (pending.end() == it)
+            ERROR(std::string{"JIT: no code for " + name}.c_str());
+        ir = std::move(it->second);
+        pending.erase(it);
+    }
+
+    // held on to, the JIT frees the context once the module is compiled
+    llvm::orc::ThreadSafeContext ctx {std::move(ir.ctx)};
+    auto remarks_file = Pipeline::open_remarks(*ctx.getContext(), remarks, remarks.file.empty() ? "" : remarks.file + '.' + name);
+
+    Pipeline::target_host_cpu(*ir.M);
+    Pipeline::optimize(*ir.M, opts);
+    if (auto err = jit->addIRModule(llvm::orc::ThreadSafeModule(std::move(ir.M), ctx)))
+        fail("cannot add " + name, std::move(err));
+
+    auto sym = jit->lookup(name);
+    if (!sym)
+        fail("cannot find " + name, sym.takeError());
+
+    // the lookup compiled the module (codegen remarks included), so the
+    // context can let go of the file
+    if (remarks_file) {
+        auto lock = ctx.getLock();
+        ctx.getContext()->setLLVMRemarkStreamer(nullptr);
+        ctx.getContext()->setMainRemarkStreamer(nullptr);
+        remarks_file->keep();
+    }
+    return sym->toPtr<Bytecode::Native_Func>();
+}
+
+void Engine::compile_async(const std::string& name, std::function<void(Bytecode::Native_Func)> done)
+{
+    std::lock_guard<std::mutex> lock {mtx};
+    workers.emplace_back([this, name, done] {
+        done(compile(name));
+    });
+}
+
+void* Engine::lookup(const std::string& symbol)
+{
+    auto sym = jit->lookup(symbol);
+    if (!sym)
+        fail("cannot find " + symbol, sym.takeError());
+    return sym->toPtr<void*>();
+}
+
+}
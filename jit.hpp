@@ -0,0 +1,62 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bytecode.hpp"
+#include "pipeline.hpp"
+
+// The JIT tier of 'rage --run': a function's IR is generated into a module
+// of its own once the function is needed (hot, or not interpretable), and
+// is then optimized and compiled in-process with ORC.
+// Remarks are reported as the functions are optimized; --remarks-file=<f>
+// writes function fn's to <f>.<fn>.
+namespace Jit
+{
+
+class Engine
+{
+public:
+    Engine(const Pipeline::Options& opts, const Pipeline::Remarks& remarks);
+    // waits for the background compiles
+    ~Engine();
+
+    // takes over the context and module the function was generated into
+    void add(const std::string& name, std::unique_ptr<llvm::LLVMContext> ctx, std::unique_ptr<llvm::Module> M);
+    bool has(const std::string& name);
+
+    // optimizes and compiles the function now
+    Bytecode::Native_Func compile(const std::string& name);
+    // same on a background thread, which then hands the result to done
+    void compile_async(const std::string& name, std::function<void(Bytecode::Native_Func)> done);
+    // another symbol of a compiled module (a parallel for's body)
+    void* lookup(const std::string& symbol);
+
+private:
+    struct Pending_IR {
+        std::unique_ptr<llvm::LLVMContext> ctx;
+        std::unique_ptr<llvm::Module> M;
+    };
+
+    Pipeline::Options opts;
+    Pipeline::Remarks remarks;
+    std::unique_ptr<llvm::orc::LLJIT> jit;
+    std::mutex mtx; // guards pending and workers
+    std::map<std::string, Pending_IR> pending;
+    std::vector<std::thread> workers;
+};
+
+}
+
+#endif
@@ -1,16 +1,147 @@
 #include "lexer.hpp"
 
+#include <algorithm>
+#include <iterator>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace Lexer
 {
 
 // returns a pointer to be able to have a null value
-const Token* Tokenizer::token() const { return curr_token<tokens.size() ? &tokens[curr_token++] : nullptr; }
-const Token* Tokenizer::peek() const { return curr_token<tokens.size() ? &tokens[curr_token] : nullptr; }
+const Token* Tokenizer::token()
+{
+    if (curr_token >= tokens.size())
+        lex_until(curr_token);
+    return curr_token<tokens.size() ? &tokens[curr_token++] : nullptr;
+}
+
+const Token* Tokenizer::peek(size_t ahead)
+{
+    if (curr_token + ahead >= tokens.size())
+        lex_until(curr_token + ahead);
+    return curr_token+ahead<tokens.size() ? &tokens[curr_token+ahead] : nullptr;
+}
+
+void Tokenizer::stream()
+{
+    stream_file.open(src_path, std::ios_base::in | std::ios_base::binary);
+    if (!stream_file) {
+        std::cout << "Error: Lexer: cannot open " << src_path << std::endl;
+        exit(1);
+    }
+}
+
+void Tokenizer::release()
+{
+    if (!stream_file.is_open())
+        return;
+    tokens.erase(tokens.begin(), tokens.begin() + static_cast<std::ptrdiff_t>(curr_token));
+    curr_token = 0;
+}
+
+void Tokenizer::lex_until(size_t n)
+{
+    while (stream_file.is_open() && tokens.size() <= n) {
+        std::string block {std::move(stream_rest)};
+        size_t old = block.size();
+        block.resize(old + stream_block_size);
+        stream_file.read(&block[old], static_cast<std::streamsize>(stream_block_size));
+        block.resize(old + static_cast<size_t>(stream_file.gcount()));
+        bool last = !stream_file;
+
+        // whole lines only, unless it's the end of the file
+        size_t cut = last ? block.size() : block.rfind('\n') + 1; // npos + 1 == 0
+        stream_rest = block.substr(cut);
+        if (last)
+            stream_file.close();
+
+        Chunk_Lexer lexer {block.data(), block.data() + cut};
+        lexer.tokenize();
+        stream_line = append(lexer, stream_line);
+    }
+}
+
+unsigned Tokenizer::append(Chunk_Lexer& chunk, unsigned line)
+{
+    if (!chunk.error.empty()) {
+        std::cout << "Error: Lexer: " << chunk.error_loc.line + line - 1 << ':' << chunk.error_loc.col
+            << ": " << chunk.error << std::endl;
+        exit(1);
+    }
+    for (Token& t : chunk.tokens) {
+        t.loc.line += line - 1;
+        tokens.push_back(std::move(t));
+    }
+    chunk.tokens = {};
+    return line + chunk.lines();
+}
 
 void Tokenizer::tokenize()
+{
+    int fd = open(src_path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        std::cout << "Error: Lexer: cannot open " << src_path << std::endl;
+        exit(1);
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    void* map = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+    close(fd);
+    if (MAP_FAILED == map) {
+        std::cout << "Error: Lexer: cannot map " << src_path << std::endl;
+        exit(1);
+    }
+
+    unsigned threads = n_threads ? n_threads : std::max(1u, std::thread::hardware_concurrency());
+    size_t n_chunks = std::max<size_t>(1, std::min<size_t>(threads, size / min_chunk_size));
+
+    // chunk i is [cuts[i], cuts[i+1]), every cut is just after a '\n'
+    const char* begin = static_cast<const char*>(map);
+    const char* end = begin + size;
+    std::vector<const char*> cuts {begin};
+    for (size_t i = 1; i < n_chunks; ++i) {
+        const char* c = begin + size * i / n_chunks;
+        c = std::find(std::max(c, cuts.back()), end, '\n');
+        if (c != end) ++c;
+        cuts.push_back(c);
+    }
+    cuts.push_back(end);
+
+    // one thread per chunk (this one takes the first), each lexes its chunk
+    // and counts its lines; nothing else needs the other chunks
+    std::vector<Chunk_Lexer> chunks;
+    for (size_t i = 0; i < n_chunks; ++i)
+        chunks.emplace_back(cuts[i], cuts[i + 1]);
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < n_chunks; ++i)
+        workers.emplace_back([&chunks, i] { chunks[i].tokenize(); });
+    chunks[0].tokenize();
+    for (auto& w : workers)
+        w.join();
+    if (map)
+        munmap(map, size);
+
+    // in order, so the error reported is the one a sequential run stops at
+    size_t total = 0;
+    for (const auto& c : chunks)
+        total += c.tokens.size();
+    tokens.reserve(total);
+    unsigned line = 1;
+    for (auto& c : chunks)
+        line = append(c, line);
+}
+
+void Tokenizer::Chunk_Lexer::tokenize()
 {
     char c;
-    while (src_file.get(c)) {
+    while (get_char(c)) {
+        Src_Loc start {pos};
+        size_t first_new = tokens.size();
         if (std::isalpha(c) || '_'==c) {
             std::string s = fulfil_name(c);
             deal_with_name(s);
@@ -21,23 +152,41 @@ void Tokenizer::tokenize()
             //TODO should expect some sort of space or bracket after
         } else if (std::isspace(c)) {
             handle_space(c);
+        } else if ('"' == c) {
+            tokens.push_back(Token{Token_type::STRING, fulfil_string()});
         } else if (std::string::npos != markers.find(c)) {
             // single characters
             tokens.push_back(Token{static_cast<Token_type>(c)});
         } else {
-            std::cout << "Error: Lexer: Invalid character '" << c << '\'' << std::endl;
-            exit(1);
+            fail(std::string{"Invalid character '"} + c + '\'');
         }
+
+        for (size_t i = first_new; i < tokens.size(); ++i)
+            tokens[i].loc = start;
     }
 }
 
+bool Tokenizer::Chunk_Lexer::get_char(char& c)
+{
+    if (cur == end)
+        return false;
+    c = *cur++;
+    if ('\n' == c) {
+        ++pos.line;
+        pos.col = 0;
+    } else {
+        ++pos.col;
+    }
+    return true;
+}
+
 //DEBUG: delete later
 const std::vector<Token>& Tokenizer::debug_get_tokens()
 {
     return tokens;
 }
 
-void Tokenizer::deal_with_name(const std::string& s)
+void Tokenizer::Chunk_Lexer::deal_with_name(const std::string& s)
 {
     auto v = keyword_mappings.find(s);
     if (keyword_mappings.end() != v) {
@@ -50,31 +199,56 @@ void Tokenizer::deal_with_name(const std::string& s)
     }
 }
 
-std::string Tokenizer::fulfil_name(char c)
+std::string Tokenizer::Chunk_Lexer::fulfil_name(char c)
 {
     std::string s {c};
-    while(std::isalnum(src_file.peek()) || src_file.peek()=='_')
-        s.push_back(src_file.get());
+    while(std::isalnum(peek_char()) || peek_char()=='_') {
+        get_char(c);
+        s.push_back(c);
+    }
     return s;
 }
 
 // numbers could be written as eg. 10_000 too (just bc of readibility)
-std::string Tokenizer::fulfil_numberlit(char c)
+std::string Tokenizer::Chunk_Lexer::fulfil_numberlit(char c)
 {
     bool saw_dot = false;
     std::string s {c};
-    char q = static_cast<char>(src_file.peek());
+    char q = static_cast<char>(peek_char());
     
     while(std::isdigit(q) || (!saw_dot && '.'==q && (saw_dot=true))) {
-        s.push_back(src_file.get());
-        q=src_file.peek();
+        get_char(c);
+        s.push_back(c);
+        q=peek_char();
     }
 
     
     return s;
 }
 
-void Tokenizer::handle_space(char c)
+// no escapes, and a string can not span lines
+std::string Tokenizer::Chunk_Lexer::fulfil_string()
+{
+    std::string s;
+    char c {};
+    int q;
+    // peeked, so an error is reported on the string's line
+    while (EOF != (q = peek_char()) && '"' != q) {
+        if ('\n' == q || '\r' == q) {
+            fail("newline in string literal.");
+            return s;
+        }
+        get_char(c);
+        s.push_back(c);
+    }
+    if (EOF == q)
+        fail("unterminated string literal.");
+    else
+        get_char(c); // the closing '"'
+    return s;
+}
+
+void Tokenizer::Chunk_Lexer::handle_space(char c)
 {
     switch(c) {
     case '\t': case ' ':
@@ -83,17 +257,16 @@ void Tokenizer::handle_space(char c)
         tokens.push_back(Token{Token_type::NL});
         break;
     case '\r':
-        src_file.get(c);
+        get_char(c);
         if ('\n' == c) {
             tokens.push_back(Token{Token_type::NL});
             break;
         } else {
-            std::cout << "Error: Lexer: handle_space(): Invalid character after '\\r'." << std::endl;
-            exit(1);
+            fail("handle_space(): Invalid character after '\\r'.");
+            break;
         }
     default:
-        std::cout << "Error: Lexer: handle_space(): unexpected space char." << std::endl;
-        exit(1);
+        fail("handle_space(): unexpected space char.");
 
     }
 }
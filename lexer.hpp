@@ -2,6 +2,7 @@
 #define LEXER_HPP
 
 #include <iostream>
+#include <cstdio> //EOF
 #include <fstream>
 #include <vector>
 #include <unordered_map>
@@ -15,12 +16,14 @@ enum class Token_type :char {
     // keywords
     IF='i', ELSE='e', RETURN='r',
     FOR='f', TO='o', TRUE='u', FALSE='a', NONE='o',
-    STREAM='s', IN='n', OUT='u',
+    STREAM='s', IN='n', OUT='u', FROM='m',
+    PARALLEL='p', REDUCE='x',
     //
     // single characters
     NL='\n',
     LBRACE='{', RBRACE='}', SC=';',
     LPAR='(', RPAR=')', ASS='=', COMMA=',',
+    LBRACKET='[', RBRACKET=']',
     PLUS='+', MINUS='-', STAR='*', DIV='/',
     HASH='#', LESS='<', GREATER='>',
     DOT='.',
@@ -32,7 +35,7 @@ enum class Token_type :char {
     ID='d',
 };
 
-static std::string markers {"{}(),.;=+-*/#<>"};
+static std::string markers {"{}()[],.;=+-*/#<>"};
 
 static std::unordered_map<std::string, Token_type> keyword_mappings = {
     // working
@@ -42,10 +45,18 @@ static std::unordered_map<std::string, Token_type> keyword_mappings = {
     {"stream", Token_type::STREAM},
     {"in", Token_type::IN},
     {"out", Token_type::OUT},
+    {"from", Token_type::FROM},
+    {"parallel", Token_type::PARALLEL},
+    {"reduce", Token_type::REDUCE},
     // integrals
     {"int32", Token_type::TYPE},
     {"int8", Token_type::TYPE},
     {"float", Token_type::TYPE},
+    {"float32", Token_type::TYPE},
+    // vectors: lanes of float or int32
+    {"float4", Token_type::TYPE},
+    {"float8", Token_type::TYPE},
+    {"int32x8", Token_type::TYPE},
     // bool
     {"true", Token_type::TRUE},
     {"false", Token_type::FALSE},
@@ -55,9 +66,16 @@ static std::unordered_map<std::string, Token_type> keyword_mappings = {
     {"none", Token_type::NONE},
 };
 
+// 1-based position in the source file
+struct Src_Loc {
+    unsigned line {0};
+    unsigned col {0};
+};
+
 struct Token {
     Token_type token_type;
     std::string value; // make it optional?
+    Src_Loc loc;
     explicit Token(Token_type t, std::string v) : token_type{t}, value{std::move(v)} {}
     explicit Token(Token_type t) : token_type{t} {}
 };
@@ -65,26 +83,84 @@ struct Token {
 class Tokenizer
 {
 public:
-    explicit Tokenizer(const char* s) : src_file{s, std::ios_base::in} {}
-    ~Tokenizer() { src_file.close(); }
+    // threads: how many threads tokenize() may use, 0 for one per core
+    explicit Tokenizer(const char* s, unsigned threads = 0) : src_path{s}, n_threads{threads} {}
 
-    const Token* token() const;
-    const Token* peek() const;
+    const Token* token();
+    const Token* peek(size_t ahead = 0);
 
     //DEBUG: delete later
     const std::vector<Token>& debug_get_tokens();
 
+    // No token spans a newline, so a big file (mapped, not read) is cut at
+    // newlines into one chunk per thread and the chunks are lexed in parallel.
     void tokenize();
 
+    // Instead of tokenize() (--stream-chunks): the file is lexed one block
+    // of lines at a time as the parser asks for tokens, and release() drops
+    // the tokens already taken, so memory holds about one function's worth.
+    void stream();
+    void release();
+
 private:
-    std::fstream src_file;
+    // don't bother splitting chunks smaller than this
+    static constexpr size_t min_chunk_size {1 << 20};
+    // bytes read at a time when streaming
+    static constexpr size_t stream_block_size {1 << 16};
+
+    // lexes [begin, end) of the source into its own tokens; lines are
+    // counted from the start of the chunk (append() makes them absolute)
+    class Chunk_Lexer
+    {
+    public:
+        Chunk_Lexer(const char* b, const char* e) : cur{b}, end{e} {}
+
+        void tokenize();
+        unsigned lines() const { return pos.line - 1; } // newlines read
+        std::vector<Token> tokens;
+        std::string error; // the first one, lexing stops there
+        Src_Loc error_loc;
+
+    private:
+        const char* cur;
+        const char* end;
+        Src_Loc pos {1, 0}; // of the last char read
+
+        // other chunks are still being lexed: record it, append() reports it
+        void fail(const std::string& msg)
+        {
+            if (error.empty()) {
+                error = msg;
+                error_loc = pos;
+            }
+            cur = end;
+        }
+
+        bool get_char(char& c);
+        int peek_char() const { return cur < end ? static_cast<unsigned char>(*cur) : EOF; }
+
+        void deal_with_name(const std::string& s);
+        std::string fulfil_name(char c);
+        std::string fulfil_numberlit(char c);
+        std::string fulfil_string();
+        void handle_space(char c);
+    };
+
+    std::string src_path;
+    unsigned n_threads;
     std::vector<Token> tokens;
-    mutable size_t curr_token {0};
+    size_t curr_token {0};
 
-    void deal_with_name(const std::string& s);
-    std::string fulfil_name(char c);
-    std::string fulfil_numberlit(char c);
-    void handle_space(char c);
+    // streaming: the file, the partial line after the last block, and the
+    // line that starts it
+    std::ifstream stream_file;
+    std::string stream_rest;
+    unsigned stream_line {1};
+    // lexes blocks until there are more than 'n' tokens, or the file ends
+    void lex_until(size_t n);
+    // moves a chunk's tokens to the end of 'tokens', its first line being
+    // 'line' (exits on its error); returns the line after the chunk
+    unsigned append(Chunk_Lexer& chunk, unsigned line);
 };
 
 }
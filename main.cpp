@@ -1,9 +1,28 @@
 #include <iostream>
 #include <string>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <cerrno>
+#include <map>
+#include <set>
+#include <vector>
 #include <memory> //unique_ptr
 
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/BinaryFormat/Dwarf.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
 #include "lexer.hpp"
 #include "parser.hpp"
+#include "server.hpp"
+#include "pipeline.hpp"
+#include "autotune.hpp"
+#include "bytecode.hpp"
+#include "jit.hpp"
 
 namespace Semantic_Parser
 {
@@ -11,25 +30,319 @@ std::unique_ptr<llvm::LLVMContext> TheContext = std::make_unique<llvm::LLVMConte
 std::unique_ptr<llvm::Module> TheModule = std::make_unique<llvm::Module>("Rage Language", *Semantic_Parser::TheContext);
 std::unique_ptr<llvm::IRBuilder<>> Builder = std::make_unique<llvm::IRBuilder<>>(*Semantic_Parser::TheContext);
 std::map<std::string, llvm::AllocaInst*> NamedValues = {};
+std::map<std::string, Array_Var> NamedArrays = {};
+std::unique_ptr<llvm::DIBuilder> DBuilder;
+llvm::DICompileUnit *TheCU = nullptr;
 }
 
-int main(int argc, char* argv[])
+// -g: describe the current module as compiled from src
+static void init_debug_info(const std::string& src)
+{
+    using namespace Semantic_Parser;
+
+    llvm::SmallString<256> path {src};
+    llvm::sys::fs::make_absolute(path);
+
+    TheModule->addModuleFlag(llvm::Module::Warning, "Debug Info Version", llvm::DEBUG_METADATA_VERSION);
+    TheModule->addModuleFlag(llvm::Module::Warning, "Dwarf Version", 4);
+    DBuilder = std::make_unique<llvm::DIBuilder>(*TheModule);
+    TheCU = DBuilder->createCompileUnit(llvm::dwarf::DW_LANG_C,
+        DBuilder->createFile(llvm::sys::path::filename(path), llvm::sys::path::parent_path(path)),
+        "rage", false, "", 0);
+}
+
+// what every module (or streamed chunk) is generated with
+struct Module_Setup {
+    std::string debug_src; // -g
+    bool native_cpu {false}; // -march=native
+    Pipeline::Options pipeline;
+    Pipeline::Remarks remarks;
+};
+
+// remarks_file: where this module's YAML remarks go, if any
+static void setup_module(const Module_Setup& setup, const std::string& remarks_file)
 {
-    Lexer::Tokenizer tokenizer {argv[1]};
-    tokenizer.tokenize();
+    Pipeline::enable_remarks(*Semantic_Parser::TheContext, setup.remarks, remarks_file);
+    Pipeline::prepare_module(*Semantic_Parser::TheModule);
+    Pipeline::prepare_builder(*Semantic_Parser::Builder, setup.pipeline);
+    if (!setup.debug_src.empty())
+        init_debug_info(setup.debug_src);
+}
+
+static void finish_module(const Module_Setup& setup)
+{
+    if (Semantic_Parser::DBuilder)
+        Semantic_Parser::DBuilder->finalize();
+    if (setup.native_cpu)
+        Pipeline::target_host_cpu(*Semantic_Parser::TheModule);
+    Pipeline::optimize(*Semantic_Parser::TheModule, setup.pipeline);
+}
+
+// throws the generated code away and starts over with a fresh context and module
+static void restart_module(const Module_Setup& setup, const std::string& remarks_file)
+{
+    using namespace Semantic_Parser;
+
+    NamedValues.clear();
+    NamedArrays.clear();
+    DBuilder.reset();
+    Builder.reset();
+    TheModule.reset();
+    TheContext = std::make_unique<llvm::LLVMContext>();
+    TheModule = std::make_unique<llvm::Module>("Rage Language", *TheContext);
+    Builder = std::make_unique<llvm::IRBuilder<>>(*TheContext);
+    setup_module(setup, remarks_file);
+}
 
-    if (3 == argc) {
-        for (auto t : tokenizer.debug_get_tokens()) {
-            std::cout << static_cast<char>(t.token_type) << ' ';
+// Streaming mode: every function is optimized and written to its own
+// bitcode file <prefix>.<n>.bc as soon as it is generated, and then the whole
+// context is thrown away, so memory is bounded by the largest function.
+// The chunks are put back together with 'llvm-link <prefix>.*.bc'.
+// With --remarks-file=<f>, chunk n's remarks go to <f>.<n>.
+static void emit_chunk(const std::string& prefix, size_t n, const Module_Setup& setup)
+{
+    using namespace Semantic_Parser;
+
+    finish_module(setup);
+
+    std::string path {prefix + '.' + std::to_string(n) + ".bc"};
+    std::error_code ec;
+    llvm::raw_fd_ostream out {path, ec, llvm::sys::fs::OF_None};
+    if (ec)
+        ERROR(std::string{"cannot write " + path + ": " + ec.message()}.c_str());
+    llvm::WriteBitcodeToFile(*TheModule, out);
+
+    restart_module(setup, setup.remarks.file.empty() ? "" : setup.remarks.file + '.' + std::to_string(n + 1));
+}
+
+// a non-negative number from the command line or the environment
+static unsigned long parse_count(const char* s, const std::string& what)
+{
+    char* end = nullptr;
+    errno = 0;
+    unsigned long n = std::strtoul(s, &end, 10);
+    if (!std::isdigit(static_cast<unsigned char>(s[0])) || *end || ERANGE == errno)
+        ERROR(std::string{what + " expects a number, got '" + s + "'"}.c_str());
+    return n;
+}
+
+// 'rage --run': executes the program instead of printing its IR.
+// Every function is turned into bytecode as it is parsed, and main starts in
+// the interpreter right after parsing: no IR is generated and LLVM isn't set
+// up until something has to be compiled.
+// A function called RAGE_JIT_THRESHOLD times, or whose loops have gone round
+// that many times, gets its IR generated and is compiled by the JIT on a
+// background thread. Once that is done, later calls to it run the machine
+// code, and a call already in the interpreter runs the rest of its
+// 'parallel for' loops with their compiled bodies, from the next chunk on.
+// Functions the interpreter can't run are compiled when they are first needed.
+// Remarks and --print-stats cover the functions that were compiled; with
+// --remarks-file=<f>, function fn's remarks go to <f>.<fn>.
+// '--run=interp' and '--run=jit' pin one tier.
+static int run(Lexer::Tokenizer& tokenizer, const Module_Setup& setup, const std::string& tier)
+{
+    using namespace Semantic_Parser;
+
+    bool use_interp = "jit" != tier;
+    bool use_jit = "interp" != tier;
+    if (!use_jit && (setup.remarks.any() || setup.remarks.stats))
+        ERROR("--run=interp doesn't optimize, so it has no remarks or statistics");
+
+    std::map<std::string, std::unique_ptr<Function_AST>> asts; // for the IR, when it is needed
+    std::map<std::string, std::unique_ptr<Bytecode::Function>> functions;
+    AST parser {tokenizer, [&](Function_AST& f) {
+        if (use_interp) {
+            std::string why;
+            if (auto fn = Bytecode::compile(f, why))
+                functions[f.name] = std::move(fn);
+            else if (!use_jit)
+                ERROR(std::string{"cannot interpret " + f.name + ": " + why}.c_str());
         }
-        std::cout << '\n';
+        if (use_jit) {
+            std::string name {f.name};
+            asts[name] = std::make_unique<Function_AST>(std::move(f));
+        }
+    }, false};
+    parser.parser();
+
+    // generates the function into a module of its own and hands it to the
+    // JIT, which is created the first time
+    std::unique_ptr<Jit::Engine> engine;
+    auto to_jit = [&](const std::string& name) -> Jit::Engine& {
+        if (!engine)
+            engine = std::make_unique<Jit::Engine>(setup.pipeline, setup.remarks);
+        restart_module(setup, "");
+        asts.at(name)->codegen();
+        if (DBuilder)
+            DBuilder->finalize();
+        // the interpreter looks the loop bodies up
+        if (auto it = functions.find(name); functions.end() != it)
+            for (const auto& l : it->second->loops)
+                TheModule->getFunction(l.ast->outlined())->setLinkage(llvm::GlobalValue::ExternalLinkage);
+        Builder.reset();
+        engine->add(name, std::move(TheContext), std::move(TheModule));
+        return *engine;
+    };
+
+    std::set<std::string> promoted;
+    auto promote = [&](Bytecode::Function& f) {
+        if (!promoted.insert(f.name).second)
+            return; // called hot again, or another of its loops is
+        Jit::Engine& jit = to_jit(f.name);
+        jit.compile_async(f.name, [&jit, &f](Bytecode::Native_Func native) {
+            for (auto& l : f.loops)
+                l.native.store(reinterpret_cast<Rage_Parallel_Body>(jit.lookup(l.ast->outlined())), std::memory_order_release);
+            f.native.store(native, std::memory_order_release);
+        });
+    };
+
+    int32_t ret = 0;
+    auto it = functions.find("main");
+    if (functions.end() != it) {
+        const char* threshold = std::getenv("RAGE_JIT_THRESHOLD");
+        Bytecode::Interpreter interp {threshold ? static_cast<uint32_t>(parse_count(threshold, "RAGE_JIT_THRESHOLD")) : 1000,
+            use_jit ? promote : std::function<void(Bytecode::Function&)>{}};
+        ret = interp.call(*it->second);
+    } else {
+        if (!asts.count("main"))
+            ERROR("no main function");
+        ret = to_jit("main").compile("main")();
+    }
+
+    std::fflush(stdout);
+    engine.reset(); // the background compiles report until they are done
+    Pipeline::finish_remarks(setup.remarks);
+    return ret;
+}
+
+// rage [-g] [-march=native] [-O<n> | --pipeline-file=<file>] [-Rpass[-missed|-analysis]=<regex>] [--remarks-file=<file>] [--print-stats]
+//      [--stream-chunks=<prefix>] [--lex-threads=N] [--lex-only] [--run[=interp|jit]] <file.ra> [print tokens]
+// 'print tokens' (any second argument) dumps the tokens, one per line, and stops;
+// --lex-only just lexes and prints how many tokens there are (bench/lex.sh times it)
+static int compile(int argc, char* argv[])
+{
+    bool debug = false;
+    bool pipeline_given = false;
+    bool lex_only = false;
+    unsigned lex_threads = 0;
+    std::string chunk_prefix;
+    std::string run_tier;
+    Module_Setup setup;
+    std::vector<const char*> positional;
+    for (int i = 1; i < argc; ++i) {
+        if (0 == std::strcmp(argv[i], "-g"))
+            debug = true;
+        else if (0 == std::strcmp(argv[i], "-march=native"))
+            setup.native_cpu = true;
+        else if (0 == std::strncmp(argv[i], "-O", 2) && 3 == std::strlen(argv[i])) {
+            setup.pipeline = Pipeline::Options::from_opt_level(argv[i][2]);
+            pipeline_given = true;
+        } else if (0 == std::strncmp(argv[i], "--pipeline-file=", 16)) {
+            setup.pipeline = Pipeline::Options::read_file(argv[i] + 16);
+            pipeline_given = true;
+        }
+        else if (0 == std::strncmp(argv[i], "-Rpass=", 7))
+            setup.remarks.passed = argv[i] + 7;
+        else if (0 == std::strncmp(argv[i], "-Rpass-missed=", 14))
+            setup.remarks.missed = argv[i] + 14;
+        else if (0 == std::strncmp(argv[i], "-Rpass-analysis=", 16))
+            setup.remarks.analysis = argv[i] + 16;
+        else if (0 == std::strncmp(argv[i], "--remarks-file=", 15))
+            setup.remarks.file = argv[i] + 15;
+        else if (0 == std::strcmp(argv[i], "--print-stats"))
+            setup.remarks.stats = true;
+        else if (0 == std::strncmp(argv[i], "--stream-chunks=", 16))
+            chunk_prefix = argv[i] + 16;
+        else if (0 == std::strncmp(argv[i], "--lex-threads=", 14))
+            lex_threads = static_cast<unsigned>(parse_count(argv[i] + 14, "--lex-threads"));
+        else if (0 == std::strcmp(argv[i], "--lex-only"))
+            lex_only = true;
+        else if (0 == std::strcmp(argv[i], "--run"))
+            run_tier = "tiered";
+        else if (0 == std::strcmp(argv[i], "--run=interp") || 0 == std::strcmp(argv[i], "--run=jit"))
+            run_tier = argv[i] + 6;
+        else if ('-' == argv[i][0] && '-' == argv[i][1])
+            ERROR(std::string{"unknown option " + std::string{argv[i]}}.c_str());
+        else
+            positional.push_back(argv[i]);
+    }
+    if (positional.empty())
+        ERROR("usage: rage [-g] [-march=native] [-O<n> | --pipeline-file=<file>] [-Rpass=<regex> ...] [--remarks-file=<file>] [--print-stats] [--stream-chunks=<prefix>] [--lex-threads=N] [--lex-only] [--run[=interp|jit]] <file.ra>");
+
+    Lexer::Tokenizer tokenizer {positional[0], lex_threads};
+    if (chunk_prefix.empty() || lex_only || 2 == positional.size())
+        tokenizer.tokenize();
+    else
+        tokenizer.stream(); // one function's tokens at a time
+
+    if (lex_only) {
+        std::cout << tokenizer.debug_get_tokens().size() << " tokens\n";
+        return 0;
+    }
+    if (2 == positional.size()) {
+        for (const auto& t : tokenizer.debug_get_tokens())
+            std::cout << static_cast<char>(t.token_type) << ' ' << t.value << ' ' << t.loc.line << ':' << t.loc.col << '\n';
+        return 0;
+    }
+
+    if (debug)
+        setup.debug_src = positional[0];
+
+    if (!run_tier.empty()) {
+        if (!chunk_prefix.empty())
+            ERROR("--run can't be combined with --stream-chunks");
+        // the JIT tier is only worth it optimized
+        if (!pipeline_given)
+            setup.pipeline = Pipeline::Options::from_opt_level('2');
+        return run(tokenizer, setup, run_tier);
     }
 
-    Semantic_Parser::AST parser {tokenizer};
+    setup_module(setup, setup.remarks.file.empty() || chunk_prefix.empty() ? setup.remarks.file : setup.remarks.file + ".0");
+
+    size_t chunks = 0;
+    Semantic_Parser::AST::Function_Sink sink;
+    if (!chunk_prefix.empty())
+        sink = [&](Semantic_Parser::Function_AST&) { emit_chunk(chunk_prefix, chunks++, setup); };
+
+    Semantic_Parser::AST parser {tokenizer, sink};
     parser.parser();
 
     // print the IR
-    Semantic_Parser::TheModule->print(llvm::outs(), nullptr);
+    if (chunk_prefix.empty()) {
+        finish_module(setup);
+        Semantic_Parser::TheModule->print(llvm::outs(), nullptr);
+    }
+    Pipeline::finish_remarks(setup.remarks);
 
     return 0;
-}
\ No newline at end of file
+}
+
+// 'rage --server': initializes the native target and the host's target
+// machine and builds the -O0..-O3 pass pipelines (running each once on an
+// empty module), so the forked requests start with all of that done
+static void warm_up()
+{
+    Pipeline::host_machine();
+    llvm::LLVMContext ctx;
+    llvm::Module M {"warm up", ctx};
+    Pipeline::prepare_module(M);
+    for (char level : {'0', '1', '2', '3'})
+        Pipeline::optimize(M, Pipeline::Options::from_opt_level(level));
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc >= 2 && 0 == std::strcmp(argv[1], "--server"))
+        return Server::run_server(argc >= 3 ? argv[2] : Server::default_socket_path(), compile, warm_up);
+
+    if (argc >= 2 && 0 == std::strcmp(argv[1], "--client"))
+        return Server::run_client(Server::default_socket_path(), {argv + 2, argv + argc});
+
+    if (argc >= 2 && 0 == std::strcmp(argv[1], "--autotune")) {
+        if (argc < 4)
+            ERROR("usage: rage --autotune <file.ra> <input> [out.pipeline]");
+        return Autotune::run(argv[2], argv[3], argc >= 5 ? argv[4] : std::string{argv[2]} + ".pipeline", compile);
+    }
+
+    return compile(argc, argv);
+}
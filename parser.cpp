@@ -21,7 +21,10 @@ void AST::parser()
 
 bool AST::handle_function_def()
 {
-    if (!next_token())
+    // skip blank lines between functions
+    while (next_token() && TT::NL == tok->token_type) {
+    }
+    if (!tok)
         return false;
     
     if (TT::TYPE != tok->token_type) {
@@ -35,6 +38,8 @@ bool AST::handle_function_def()
     if (TT::ID != next_token()->token_type)
         ERROR("In handle_function_def(): expected ID");
     std::string func_name {tok->value};
+    Lexer::Src_Loc func_loc {tok->loc};
+    vector_vars.clear();
     
     if (TT::LPAR != next_token()->token_type
         || TT::RPAR != next_token()->token_type) {
@@ -62,7 +67,13 @@ bool AST::handle_function_def()
         ERROR("In handle_function_def(): expected '}'");
 
     Function_AST func {func_type, func_name, std::move(body)};
-    func.codegen();
+    func.loc = func_loc;
+    if (gen_ir)
+        func.codegen();
+
+    if (on_function)
+        on_function(func);
+    toker.release(); // (streaming) this function's tokens aren't needed anymore
 
     return true;
 }
@@ -74,24 +85,35 @@ std::unique_ptr<AST_Node> AST::handle_statement()
 {
     ignore_token(TT::NL);
 
+    // every statement is located at its first token
+    Lexer::Src_Loc loc {toker.peek()->loc};
+    auto at_loc = [&loc](std::unique_ptr<AST_Node> stm) {
+        if (stm) stm->loc = loc;
+        return stm;
+    };
+
     switch (toker.peek()->token_type)
     {
     case TT::STREAM:
-        return handle_stream();
+        return at_loc(handle_stream());
     case TT::TYPE:
-        return handle_var_decl(); // can pass as parameter what token_type to end on, e.g TT::NL
+        if (toker.peek(1) && TT::LBRACKET == toker.peek(1)->token_type)
+            return at_loc(handle_array_decl());
+        return at_loc(handle_var_decl()); // can pass as parameter what token_type to end on, e.g TT::NL
     case TT::RETURN: {
         std::unique_ptr<Return_AST> ret {handle_return()};
         ignore_token(TT::NL);
         if (TT::RBRACE != toker.peek()->token_type)
             ERROR("After 'return' expect '}'");
         ret_val.yes = true;
-        return std::move(ret);
+        return at_loc(std::move(ret));
     }
     case TT::IF:
-        return handle_if();
+        return at_loc(handle_if());
+    case TT::PARALLEL:
+        return at_loc(handle_parallel_for());
     case TT::ID:
-        return handle_assignment();
+        return at_loc(handle_assignment());
     case TT::RBRACE:
         //!
         //TODO
@@ -117,14 +139,36 @@ std::unique_ptr<Stream_AST> AST::handle_stream()
     
     if (TT::ID != next_token()->token_type)
         ERROR("In handle_stream: expected an ID.");
+    std::string id {tok->value};
+
+    // stream.in arr from "file" / stream.out arr to "file"
+    std::string file;
+    if (toker.peek() && (TT::FROM == toker.peek()->token_type || TT::TO == toker.peek()->token_type)) {
+        if ((TT::IN == op) != (TT::FROM == next_token()->token_type))
+            ERROR("In handle_stream: expected 'stream.in ... from' or 'stream.out ... to'.");
+        if (TT::STRING != next_token()->token_type)
+            ERROR("In handle_stream: expected a file name string.");
+        file = tok->value;
+    }
     
-    return std::make_unique<Stream_AST>(tok->value, op==TT::IN ? "scanf" : "printf");
+    return std::make_unique<Stream_AST>(id, op==TT::IN ? "scanf" : "printf", file);
 }
 
-std::unique_ptr<Var_Assignment_AST> AST::handle_assignment()
+std::unique_ptr<AST_Node> AST::handle_assignment()
 {
     //TODO ignore TT::NL (?)
     std::string id {next_token()->value};
+
+    if (TT::LBRACKET == toker.peek()->token_type) {
+        std::unique_ptr<Expr_AST> index {handle_index()};
+        check_lane(id, *index);
+        if (TT::ASS != next_token()->token_type)
+            ERROR("In handle_assignment(): expected '='");
+        std::unique_ptr<Expr_AST> expr {handle_expr()};
+        if (!expr) ERROR("In handle_assignment(): invalid expression");
+        return std::make_unique<Array_Assignment_AST>(id, std::move(index), std::move(expr));
+    }
+
     if (TT::ASS != next_token()->token_type)
         ERROR("In handle_assignment(): expected '='");
     std::unique_ptr<Expr_AST> expr {handle_expr()};
@@ -180,6 +224,63 @@ std::unique_ptr<If_Else_AST> AST::handle_if()
     );
 }
 
+std::unique_ptr<Parallel_For_AST> AST::handle_parallel_for()
+{
+    next_token(); // eat 'parallel'
+    if (TT::FOR != next_token()->token_type)
+        ERROR("In handle_parallel_for(): expected 'for' after 'parallel'");
+    if (TT::ID != next_token()->token_type)
+        ERROR("In handle_parallel_for(): expected the loop variable");
+    std::string var {tok->value};
+    if (TT::ASS != next_token()->token_type)
+        ERROR("In handle_parallel_for(): expected '='");
+
+    std::unique_ptr<Expr_AST> from {handle_expr()};
+    if (!from)
+        ERROR("In handle_parallel_for(): invalid start");
+    if (TT::TO != next_token()->token_type)
+        ERROR("In handle_parallel_for(): expected 'to'");
+    std::unique_ptr<Expr_AST> to {handle_expr()};
+    if (!to)
+        ERROR("In handle_parallel_for(): invalid end");
+
+    char reduce_op = 0;
+    std::string reduce_var;
+    if (TT::REDUCE == toker.peek()->token_type) {
+        next_token();
+        TT op = next_token()->token_type;
+        if (TT::PLUS != op && TT::STAR != op)
+            ERROR("In handle_parallel_for(): expected '+' or '*' after 'reduce'");
+        reduce_op = static_cast<char>(op);
+        if (TT::ID != next_token()->token_type)
+            ERROR("In handle_parallel_for(): expected the reduce variable");
+        reduce_var = tok->value;
+    }
+
+    ignore_token(TT::NL);
+    if (TT::LBRACE != next_token()->token_type)
+        ERROR("In handle_parallel_for(): expected '{'");
+
+    // a 'return' before the loop is the enclosing function's business
+    bool saved_ret = ret_val.yes;
+    ret_val.yes = false;
+    std::vector<std::unique_ptr<AST_Node>> body;
+    while (true) {
+        auto s = handle_statement();
+        if (!s) break;
+        body.push_back(std::move(s));
+    }
+    if (ret_val.yes)
+        ERROR("In handle_parallel_for(): 'return' inside 'parallel for'");
+    ret_val.yes = saved_ret;
+
+    if (TT::RBRACE != next_token()->token_type)
+        ERROR("In handle_parallel_for(): expected '}' after the body");
+
+    return std::make_unique<Parallel_For_AST>(var, std::move(from), std::move(to),
+        reduce_op, reduce_var, std::move(body));
+}
+
 std::unique_ptr<Var_Declaration_AST> AST::handle_var_decl()
 {
     std::string type0 = next_token()->value;
@@ -196,12 +297,77 @@ std::unique_ptr<Var_Declaration_AST> AST::handle_var_decl()
     
     ignore_token(TT::NL);
 
-    if (std::unique_ptr<Expr_AST> expr {handle_expr()})
+    if (std::unique_ptr<Expr_AST> expr {handle_expr()}) {
+        if (unsigned lanes = vector_lanes(type0))
+            vector_vars[name0] = lanes;
+        else
+            vector_vars.erase(name0);
         return std::make_unique<Var_Declaration_AST>(type0, name0, std::move(expr));
+    }
     
     return nullptr;
 }
 
+std::unique_ptr<Array_Declaration_AST> AST::handle_array_decl()
+{
+    std::string type0 = next_token()->value;
+
+    if (TT::LBRACKET != next_token()->token_type)
+        ERROR("In handle_array_decl(): expected '['");
+    if (TT::NUM_LIT != next_token()->token_type || std::string::npos != tok->value.find('.'))
+        ERROR("In handle_array_decl(): expected the array size");
+    size_t size = std::stoull(tok->value);
+    if (TT::RBRACKET != next_token()->token_type)
+        ERROR("In handle_array_decl(): expected ']'");
+
+    if (TT::ID != next_token()->token_type)
+        ERROR("In handle_array_decl(): expected ID");
+    vector_vars.erase(tok->value);
+
+    return std::make_unique<Array_Declaration_AST>(type0, tok->value, size);
+}
+
+// '[' expr ']'
+std::unique_ptr<Expr_AST> AST::handle_index()
+{
+    next_token(); // eat '['
+    std::unique_ptr<Expr_AST> index {handle_expr()};
+    if (!index)
+        ERROR("In handle_index(): invalid index");
+    if (TT::RBRACKET != next_token()->token_type)
+        ERROR("In handle_index(): expected ']'");
+    return index;
+}
+
+// a constant lane index must be inside the vector (a computed one isn't checked)
+void AST::check_lane(const std::string& name, const Expr_AST& index)
+{
+    auto it = vector_vars.find(name);
+    auto num = dynamic_cast<const Number_Expr_AST*>(&index);
+    if (vector_vars.end() == it || !num)
+        return;
+    double lane = num->value();
+    if (lane < 0 || lane >= it->second)
+        ERROR(std::string{"lane " + std::to_string(static_cast<long long>(lane)) + " of " + name
+            + " is out of range, it has " + std::to_string(it->second) + " lanes"}.c_str());
+}
+
+// reduce_xxx '(' expr ')', tok is the name
+std::unique_ptr<Reduce_Expr_AST> AST::handle_reduce()
+{
+    std::string func {tok->value};
+    if ("reduce_add" != func && "reduce_mul" != func && "reduce_min" != func && "reduce_max" != func)
+        ERROR(std::string{"In handle_reduce(): unknown function " + func}.c_str());
+
+    next_token(); // eat '('
+    std::unique_ptr<Expr_AST> arg {handle_expr()};
+    if (!arg)
+        ERROR("In handle_reduce(): invalid argument");
+    if (TT::RPAR != next_token()->token_type)
+        ERROR("In handle_reduce(): expected ')'");
+    return std::make_unique<Reduce_Expr_AST>(func, std::move(arg));
+}
+
 std::unique_ptr<Return_AST> AST::handle_return()
 {
     next_token(); //eat 'return'
@@ -219,12 +385,24 @@ std::unique_ptr<Expr_AST> AST::handle_expr(std::unique_ptr<Binary_Expr_AST>* pre
         return nullptr;
 
     std::unique_ptr<Expr_AST> LHS;
+    Lexer::Src_Loc loc {tok->loc};
 
     switch (tok->token_type) {
         case TT::NUM_LIT:
             LHS = std::make_unique<Number_Expr_AST>(std::stod(tok->value));
             break;
         case TT::ID:
+            if (TT::LPAR == toker.peek()->token_type) {
+                LHS = handle_reduce();
+                break;
+            }
+            if (TT::LBRACKET == toker.peek()->token_type) {
+                std::string name {tok->value};
+                std::unique_ptr<Expr_AST> index {handle_index()};
+                check_lane(name, *index);
+                LHS = std::make_unique<Array_Elem_Expr_AST>(name, std::move(index));
+                break;
+            }
             LHS = std::make_unique<Var_Expr_AST>(tok->value);
             break;
             // might also be a function call
@@ -232,6 +410,7 @@ std::unique_ptr<Expr_AST> AST::handle_expr(std::unique_ptr<Binary_Expr_AST>* pre
             std::cout << "Token " << static_cast<char>(tok->token_type) << '\n';
             ERROR("Semantic Parser: in handle_expr()");
     }
+    LHS->loc = loc;
 
     if (!is_math_op( toker.peek()->token_type ))
         return LHS;
@@ -240,6 +419,7 @@ std::unique_ptr<Expr_AST> AST::handle_expr(std::unique_ptr<Binary_Expr_AST>* pre
     
     std::unique_ptr<Binary_Expr_AST> expr = std::make_unique<Binary_Expr_AST>();
     expr->op = static_cast<Math_Op>(static_cast<char>(tok->token_type));
+    expr->loc = tok->loc;
     expr->LHS = std::move(LHS);
 
     if (!prev_exp || op_precedence[expr->op] >= op_precedence[prev_exp->get()->op]) {
@@ -255,7 +435,9 @@ std::unique_ptr<Expr_AST> AST::handle_expr(std::unique_ptr<Binary_Expr_AST>* pre
         std::move(prev_LHS),
         std::move(expr->LHS)
     );
+    prev_exp->get()->LHS->loc = prev_exp->get()->loc;
     prev_exp->get()->op = expr->op;
+    prev_exp->get()->loc = expr->loc;
     
     return handle_expr(prev_exp);
 }
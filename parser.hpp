@@ -6,6 +6,7 @@
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/DIBuilder.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
@@ -20,14 +21,18 @@
 #include <map> //llvm
 #include <string>
 #include <memory> //unique_ptr
+#include <functional>
 
 #include "lexer.hpp"
+#include "runtime.hpp"
 
 [[noreturn]] inline void ERROR(const char* msg) {
     std::cout << "Error: " << msg << std::endl;
     exit(1);
 }
 
+namespace Bytecode { class Function_Builder; }
+
 namespace Semantic_Parser
 {
 
@@ -37,6 +42,31 @@ extern std::unique_ptr<llvm::Module> TheModule;
 extern std::unique_ptr<llvm::IRBuilder<>> Builder;
 extern std::map<std::string, llvm::AllocaInst*> NamedValues;
 
+// debug info, only when compiling with -g (DBuilder is null otherwise)
+extern std::unique_ptr<llvm::DIBuilder> DBuilder;
+extern llvm::DICompileUnit *TheCU;
+
+// attaches the location to the instructions generated from now on
+void emit_location(const Lexer::Src_Loc& loc);
+
+struct Array_Var {
+    llvm::Type *elem_ty;
+    Runtime::Elem_Kind kind;
+    llvm::AllocaInst *data; // pointer to the first element
+    llvm::AllocaInst *len;  // number of elements (i64)
+};
+extern std::map<std::string, Array_Var> NamedArrays;
+
+// 'float' -> F64, 'float32' -> F32, ...
+Runtime::Elem_Kind array_elem_kind(const std::string& type);
+
+// float4/float8 (lanes of double) and int32x8 (lanes of i32)
+bool is_vector_type(const std::string& type);
+// number of lanes of a vector type, 0 for anything else
+unsigned vector_lanes(const std::string& type);
+// what a variable declared as 'type' holds: a double, or an LLVM vector
+llvm::Type *value_type(const std::string& type);
+
 enum class Math_Op :char {
     PLUS='+', MINUS='-', MULT='*', DIV='/'
 };
@@ -54,13 +84,19 @@ extern Ret_Val ret_val;
 
 class AST_Node {
 public:
+    Lexer::Src_Loc loc;
     virtual llvm::Value *codegen() =0;
+    // the interpreter's version of codegen(), see bytecode.cpp
+    virtual void bytecode(Bytecode::Function_Builder& fb) =0;
     virtual ~AST_Node() =default; //why is this needed?
 };
 
 class Expr_AST {
 public:
+    Lexer::Src_Loc loc;
     virtual llvm::Value *codegen() =0;
+    // returns the register that will hold the value
+    virtual int bytecode(Bytecode::Function_Builder& fb) =0;
     virtual ~Expr_AST() =default;
 };
 
@@ -78,13 +114,16 @@ public:
         : op{o}, LHS{std::move(L)}, RHS{std::move(R)} {}
     
     llvm::Value *codegen();
+    int bytecode(Bytecode::Function_Builder& fb);
 };
 
 class Number_Expr_AST : public Expr_AST {
     double val;
 public:
     explicit Number_Expr_AST(double v) : val{v} {}
+    double value() const { return val; }
     llvm::Value *codegen();
+    int bytecode(Bytecode::Function_Builder& fb);
 };
 
 class Var_Expr_AST : public Expr_AST {
@@ -93,6 +132,35 @@ public:
     explicit Var_Expr_AST(const std::string& n) : name{n} {} // is move() worth it?
     
     llvm::Value *codegen();
+    int bytecode(Bytecode::Function_Builder& fb);
+};
+
+// arr[index]
+class Array_Elem_Expr_AST : public Expr_AST {
+    std::string name;
+    std::unique_ptr<Expr_AST> index;
+public:
+    Array_Elem_Expr_AST(std::string n, std::unique_ptr<Expr_AST> i)
+        : name{std::move(n)}, index{std::move(i)} {}
+
+    llvm::Value *codegen();
+    int bytecode(Bytecode::Function_Builder& fb);
+
+    // address of arr[index], also used when assigning to an element
+    static llvm::Value *element_ptr(const std::string& name, Expr_AST& index, Array_Var& arr);
+};
+
+// reduce_add(v), reduce_mul(v), reduce_min(v), reduce_max(v):
+// combines the lanes of a vector into one float
+class Reduce_Expr_AST : public Expr_AST {
+    std::string func;
+    std::unique_ptr<Expr_AST> arg;
+public:
+    Reduce_Expr_AST(std::string f, std::unique_ptr<Expr_AST> a)
+        : func{std::move(f)}, arg{std::move(a)} {}
+
+    llvm::Value *codegen();
+    int bytecode(Bytecode::Function_Builder& fb);
 };
 
 class Var_Declaration_AST : public AST_Node {
@@ -104,15 +172,16 @@ public:
         : data_type{dt}, var_name{std::move(vn)}, expr{(std::move(ex))} {}
     
     llvm::Value *codegen();
+    void bytecode(Bytecode::Function_Builder& fb);
 
     // helper function to ensure that 'alloca's are created
     // at the beginning of the function
     // TmpB is pointing at the first instruction of the entry block of the function
-    // assumes varible type is double (for now) //TODO
-    static llvm::AllocaInst *create_alloca_in_entryblock(llvm::Function *TheFunction, const std::string &var_name)
+    // the variable is a double unless ty says otherwise (vectors)
+    static llvm::AllocaInst *create_alloca_in_entryblock(llvm::Function *TheFunction, const std::string &var_name, llvm::Type *ty = nullptr)
     {
         llvm::IRBuilder<> TmpB(&TheFunction->getEntryBlock(), TheFunction->getEntryBlock().begin());
-        return TmpB.CreateAlloca(llvm::Type::getDoubleTy(*TheContext), nullptr, var_name);
+        return TmpB.CreateAlloca(ty ? ty : llvm::Type::getDoubleTy(*TheContext), nullptr, var_name);
     }
 };
 
@@ -125,6 +194,34 @@ public:
         : id{i}, expr{std::move(e)} {}
     
     llvm::Value* codegen();
+    void bytecode(Bytecode::Function_Builder& fb);
+};
+
+// float[N] arr
+// elements start as 0 and are stored with the declared type
+class Array_Declaration_AST : public AST_Node {
+public:
+    std::string data_type;
+    std::string var_name;
+    size_t size;
+    Array_Declaration_AST(std::string dt, std::string vn, size_t s)
+        : data_type{std::move(dt)}, var_name{std::move(vn)}, size{s} {}
+
+    llvm::Value *codegen();
+    void bytecode(Bytecode::Function_Builder& fb);
+};
+
+class Array_Assignment_AST : public AST_Node
+{
+    std::string id;
+    std::unique_ptr<Expr_AST> index;
+    std::unique_ptr<Expr_AST> expr;
+public:
+    Array_Assignment_AST(std::string i, std::unique_ptr<Expr_AST> idx, std::unique_ptr<Expr_AST> e)
+        : id{std::move(i)}, index{std::move(idx)}, expr{std::move(e)} {}
+
+    llvm::Value* codegen();
+    void bytecode(Bytecode::Function_Builder& fb);
 };
 
 class Return_AST : public AST_Node {
@@ -133,6 +230,7 @@ public:
     explicit Return_AST(std::unique_ptr<Expr_AST> ex) : expr{std::move(ex)} {}
 
     llvm::Value *codegen();
+    void bytecode(Bytecode::Function_Builder& fb);
 };
 
 class If_Else_AST : public AST_Node {
@@ -143,6 +241,31 @@ public:
         : cond{std::move(c)}, if_body{std::move(i)}, else_body{std::move(e)} {}
     
     llvm::Value* codegen();
+    void bytecode(Bytecode::Function_Builder& fb);
+};
+
+// parallel for i = a to b [reduce +|* s] { ... }
+// i goes from a to b, both included. The body is outlined into its own
+// function, run by the runtime's thread pool on chunks of the range; it
+// sees the enclosing variables through pointers, may assign only s and
+// shares the arrays' elements.
+class Parallel_For_AST : public AST_Node {
+    std::string var;
+    std::unique_ptr<Expr_AST> from, to;
+    char reduce_op; // '+', '*', or 0 without 'reduce'
+    std::string reduce_var;
+    std::vector<std::unique_ptr<AST_Node>> body;
+    std::string body_name;
+public:
+    Parallel_For_AST(std::string v, std::unique_ptr<Expr_AST> f, std::unique_ptr<Expr_AST> t,
+        char op, std::string rv, std::vector<std::unique_ptr<AST_Node>> b)
+        : var{std::move(v)}, from{std::move(f)}, to{std::move(t)},
+          reduce_op{op}, reduce_var{std::move(rv)}, body{std::move(b)} {}
+
+    llvm::Value* codegen();
+    void bytecode(Bytecode::Function_Builder& fb);
+    // the outlined body's symbol, once codegen() has run
+    const std::string& outlined() const { return body_name; }
 };
 
 class Function_AST : public AST_Node {
@@ -155,30 +278,44 @@ public:
         : ty{t}, name{n}, body{std::move(b)} {}
     
     llvm::Value* codegen();
+    void bytecode(Bytecode::Function_Builder& fb);
 };
 
 class Stream_AST : public AST_Node {
     std::string id;
     std::string internal_func_name;
+    std::string file; // 'stream.in arr from "file"', arrays only
 
 public:
-    Stream_AST(std::string i, std::string f)
-        : id{i}, internal_func_name{f} {}
+    Stream_AST(std::string i, std::string f, std::string fl = "")
+        : id{i}, internal_func_name{f}, file{std::move(fl)} {}
 
     llvm::Value* codegen();
+    void bytecode(Bytecode::Function_Builder& fb);
+    llvm::Value* codegen_array();
+    llvm::Value* codegen_vector(llvm::AllocaInst *vec);
 };
 
 class AST
 {
 public:
-    AST(const Lexer::Tokenizer& t) : toker{t} {}
+    // called after each function has been generated into TheModule
+    // (or just parsed, when gen_ir is false)
+    using Function_Sink = std::function<void(Function_AST&)>;
+
+    AST(Lexer::Tokenizer& t, Function_Sink s = nullptr, bool gen_ir = true)
+        : toker{t}, on_function{std::move(s)}, gen_ir{gen_ir} {}
     void parser();
 
 private:
     using TT = Lexer::Token_type;
     //using Tk = Lexer::Token;
-    const Lexer::Tokenizer& toker;
+    Lexer::Tokenizer& toker;
+    Function_Sink on_function;
+    bool gen_ir;
     const Lexer::Token* tok;
+    // lane counts of the vector variables declared so far in this function
+    std::map<std::string, unsigned> vector_vars;
 
     // big problem: in all of my code im not checking if the value is nullptr before accessing it
     inline const Lexer::Token* next_token() { return tok = toker.token(); }
@@ -187,9 +324,14 @@ private:
     bool handle_function_def();
     std::unique_ptr<AST_Node> handle_statement();
     std::unique_ptr<Stream_AST> handle_stream();
-    std::unique_ptr<Var_Assignment_AST> handle_assignment();
+    std::unique_ptr<AST_Node> handle_assignment();
     std::unique_ptr<If_Else_AST> handle_if();
+    std::unique_ptr<Parallel_For_AST> handle_parallel_for();
     std::unique_ptr<Var_Declaration_AST> handle_var_decl();
+    std::unique_ptr<Array_Declaration_AST> handle_array_decl();
+    std::unique_ptr<Expr_AST> handle_index();
+    void check_lane(const std::string& name, const Expr_AST& index);
+    std::unique_ptr<Reduce_Expr_AST> handle_reduce();
     std::unique_ptr<Return_AST> handle_return();
     std::unique_ptr<Expr_AST> handle_expr(std::unique_ptr<Binary_Expr_AST>* prev_exp=nullptr);
 
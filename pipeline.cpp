@@ -0,0 +1,340 @@
+#include "pipeline.hpp"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/CGSCCPassManager.h"
+#include "llvm/Analysis/LoopAnalysisManager.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/DiagnosticHandler.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/LLVMRemarkStreamer.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/Regex.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#include "llvm/TargetParser/Host.h"
+
+#include <iostream>
+#include <fstream>
+#include <charconv>
+#include <climits>
+#include <cctype>
+#include <vector>
+#include <memory>
+#include <map>
+#include <sstream>
+
+namespace Pipeline
+{
+
+[[noreturn]] static void fail(const std::string& msg)
+{
+    std::cout << "Error: Pipeline: " << msg << std::endl;
+    exit(1);
+}
+
+Options Options::from_opt_level(char level)
+{
+    if (level < '0' || level > '3')
+        fail(std::string{"invalid optimization level -O"} + level);
+    Options opts;
+    opts.passes = std::string{"default<O"} + level + '>';
+    return opts;
+}
+
+Options Options::read_file(const std::string& path)
+{
+    std::ifstream in {path};
+    if (!in)
+        fail("cannot open " + path);
+
+    Options opts;
+    std::string line;
+    unsigned n = 0;
+    // a whole decimal number in [lo, hi], or an error naming the line
+    auto number = [&](const std::string& key, const std::string& val, long lo, long hi) {
+        long v = 0;
+        auto [end, ec] = std::from_chars(val.data(), val.data() + val.size(), v);
+        if (std::errc{} != ec || val.data() + val.size() != end || v < lo || v > hi)
+            fail(path + ':' + std::to_string(n) + ": bad value for " + key + ": '" + val + "'");
+        return v;
+    };
+    while (std::getline(in, line)) {
+        ++n;
+        line = line.substr(0, line.find('#'));
+        while (!line.empty() && std::isspace(static_cast<unsigned char>(line.back())))
+            line.pop_back();
+        if (line.empty())
+            continue;
+
+        size_t eq = line.find('=');
+        if (std::string::npos == eq)
+            fail(path + ':' + std::to_string(n) + ": expected key=value, got '" + line + "'");
+        std::string key {line.substr(0, eq)}, val {line.substr(eq + 1)};
+
+        if ("passes" == key) opts.passes = val;
+        else if ("unroll" == key) opts.unroll = number(key, val, 0, 1);
+        else if ("unroll-count" == key) opts.unroll_count = static_cast<unsigned>(number(key, val, 0, INT_MAX));
+        else if ("vectorize" == key) opts.vectorize = number(key, val, 0, 1);
+        else if ("vector-width" == key) opts.vector_width = static_cast<unsigned>(number(key, val, 0, INT_MAX));
+        else if ("slp" == key) opts.slp = number(key, val, 0, 1);
+        else if ("inline-threshold" == key) opts.inline_threshold = static_cast<int>(number(key, val, -1, INT_MAX));
+        else if ("fast-math" == key) opts.fast_math = number(key, val, 0, 1);
+        else fail(path + ':' + std::to_string(n) + ": unknown key " + key);
+    }
+    return opts;
+}
+
+void Options::write_file(const std::string& path) const
+{
+    std::ofstream out {path};
+    if (!out)
+        fail("cannot write " + path);
+    out << text();
+}
+
+std::string Options::text() const
+{
+    std::ostringstream out;
+    out << "passes=" << passes << '\n'
+        << "unroll=" << unroll << '\n'
+        << "unroll-count=" << unroll_count << '\n'
+        << "vectorize=" << vectorize << '\n'
+        << "vector-width=" << vector_width << '\n'
+        << "slp=" << slp << '\n'
+        << "inline-threshold=" << inline_threshold << '\n'
+        << "fast-math=" << fast_math << '\n';
+    return out.str();
+}
+
+// prints the remarks selected by -Rpass*, like clang does
+struct Remark_Printer : llvm::DiagnosticHandler {
+    std::unique_ptr<llvm::Regex> passed, missed, analysis;
+
+    static std::unique_ptr<llvm::Regex> compile_regex(const std::string& pattern, const char* flag)
+    {
+        if (pattern.empty())
+            return nullptr;
+        auto re = std::make_unique<llvm::Regex>(pattern);
+        std::string error;
+        if (!re->isValid(error))
+            fail(std::string{flag} + pattern + ": " + error);
+        return re;
+    }
+
+    explicit Remark_Printer(const Remarks& r)
+        : passed{compile_regex(r.passed, "-Rpass=")},
+          missed{compile_regex(r.missed, "-Rpass-missed=")},
+          analysis{compile_regex(r.analysis, "-Rpass-analysis=")} {}
+
+    bool isPassedOptRemarkEnabled(llvm::StringRef pass) const override { return passed && passed->match(pass); }
+    bool isMissedOptRemarkEnabled(llvm::StringRef pass) const override { return missed && missed->match(pass); }
+    bool isAnalysisRemarkEnabled(llvm::StringRef pass) const override { return analysis && analysis->match(pass); }
+    bool isAnyRemarkEnabled() const override { return passed || missed || analysis; }
+
+    bool handleDiagnostics(const llvm::DiagnosticInfo& DI) override
+    {
+        const auto *R = llvm::dyn_cast<llvm::DiagnosticInfoOptimizationBase>(&DI);
+        if (!R)
+            return false; // not a remark: default handling
+        if (!R->isEnabled())
+            return true;
+
+        // one write per remark, the JIT's threads share stderr
+        std::string line;
+        llvm::raw_string_ostream os {line};
+        if (R->isLocationAvailable()) {
+            llvm::DiagnosticLocation loc = R->getLocation();
+            os << loc.getRelativePath() << ':' << loc.getLine() << ':' << loc.getColumn() << ": ";
+        } else {
+            os << R->getFunction().getName() << ": ";
+        }
+        os << "remark: " << R->getMsg() << " [" << R->getPassName() << "]\n";
+        llvm::errs() << os.str();
+        return true;
+    }
+};
+
+// the YAML file of the current context
+static std::unique_ptr<llvm::ToolOutputFile> remarks_out;
+
+void enable_remarks(llvm::LLVMContext& ctx, const Remarks& remarks, const std::string& file)
+{
+    if (remarks_out) {
+        remarks_out->keep();
+        remarks_out.reset();
+    }
+    enable_statistics(remarks);
+    remarks_out = open_remarks(ctx, remarks, file);
+}
+
+std::unique_ptr<llvm::ToolOutputFile> open_remarks(llvm::LLVMContext& ctx, const Remarks& remarks, const std::string& file)
+{
+    if (!remarks.any())
+        return nullptr;
+
+    ctx.setDiagnosticHandler(std::make_unique<Remark_Printer>(remarks));
+
+    if (file.empty())
+        return nullptr;
+    auto out = llvm::setupLLVMOptimizationRemarks(ctx, file, "", "yaml", false);
+    if (!out)
+        fail("cannot write remarks to " + file + ": " + llvm::toString(out.takeError()));
+    return std::move(*out);
+}
+
+void enable_statistics(const Remarks& remarks)
+{
+    if (remarks.stats)
+        llvm::EnableStatistics(false);
+}
+
+void finish_remarks(const Remarks& remarks)
+{
+    if (remarks_out) {
+        remarks_out->keep();
+        remarks_out.reset();
+    }
+    // counters only exist in LLVM builds with assertions or LLVM_FORCE_ENABLE_STATS
+    if (remarks.stats)
+        llvm::PrintStatistics(llvm::errs());
+}
+
+llvm::TargetMachine *host_machine()
+{
+    static std::unique_ptr<llvm::TargetMachine> TM;
+    if (TM)
+        return TM.get();
+
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+
+    std::string triple {llvm::sys::getDefaultTargetTriple()};
+    std::string error;
+    const llvm::Target *target = llvm::TargetRegistry::lookupTarget(triple, error);
+    if (!target)
+        fail(error);
+
+    // the CPU name implies its features (avx2, ...)
+    TM.reset(target->createTargetMachine(triple, llvm::sys::getHostCPUName(), "",
+        llvm::TargetOptions{}, llvm::Reloc::PIC_));
+    return TM.get();
+}
+
+void prepare_module(llvm::Module& M)
+{
+    llvm::TargetMachine *TM = host_machine();
+    M.setTargetTriple(TM->getTargetTriple().str());
+    M.setDataLayout(TM->createDataLayout());
+}
+
+void prepare_builder(llvm::IRBuilder<>& B, const Options& opts)
+{
+    if (opts.fast_math)
+        B.setFastMathFlags(llvm::FastMathFlags::getFast());
+}
+
+// unroll count and vector width have no pipeline option, so hang them on
+// each loop as metadata; LLVM's command line flags would be process-wide
+static void tag_loops(llvm::Module& M, const Options& opts)
+{
+    bool unroll {opts.unroll && opts.unroll_count}, widen {opts.vectorize && opts.vector_width};
+    if (!unroll && !widen)
+        return;
+
+    llvm::LLVMContext& C {M.getContext()};
+    llvm::Type* i32 {llvm::Type::getInt32Ty(C)};
+    auto hint = [&](const char* name, llvm::Constant* value) {
+        return llvm::MDNode::get(C, {llvm::MDString::get(C, name), llvm::ConstantAsMetadata::get(value)});
+    };
+
+    for (llvm::Function& F : M) {
+        if (F.isDeclaration())
+            continue;
+        llvm::DominatorTree DT {F};
+        llvm::LoopInfo LI {DT};
+        for (llvm::Loop* L : LI.getLoopsInPreorder()) {
+            llvm::SmallVector<llvm::Metadata*, 4> ops {nullptr};
+            if (llvm::MDNode* old = L->getLoopID())
+                for (unsigned i = 1; i < old->getNumOperands(); ++i)
+                    ops.push_back(old->getOperand(i));
+            if (unroll)
+                ops.push_back(hint("llvm.loop.unroll.count", llvm::ConstantInt::get(i32, opts.unroll_count)));
+            if (widen)
+                ops.push_back(hint("llvm.loop.vectorize.width", llvm::ConstantInt::get(i32, opts.vector_width)));
+            llvm::MDNode* id {llvm::MDNode::getDistinct(C, ops)};
+            id->replaceOperandWith(0, id);
+            L->setLoopID(id);
+        }
+    }
+}
+
+void target_host_cpu(llvm::Module& M)
+{
+    llvm::StringRef cpu = host_machine()->getTargetCPU();
+    for (llvm::Function& F : M)
+        if (!F.isDeclaration() && !F.hasFnAttribute("target-cpu"))
+            F.addFnAttr("target-cpu", cpu);
+}
+
+static llvm::PipelineTuningOptions tuning(const Options& opts)
+{
+    llvm::PipelineTuningOptions PTO;
+    PTO.LoopUnrolling = opts.unroll;
+    PTO.LoopVectorization = opts.vectorize;
+    PTO.SLPVectorization = opts.slp;
+    if (opts.inline_threshold >= 0)
+        PTO.InlinerThreshold = opts.inline_threshold;
+    return PTO;
+}
+
+// a parsed pass pipeline and its analysis managers (the registered analyses
+// point into the PassBuilder, so it lives as long as they do)
+struct Built_Pipeline {
+    llvm::PassBuilder PB;
+    llvm::LoopAnalysisManager LAM;
+    llvm::FunctionAnalysisManager FAM;
+    llvm::CGSCCAnalysisManager CGAM;
+    llvm::ModuleAnalysisManager MAM;
+    llvm::ModulePassManager MPM;
+
+    explicit Built_Pipeline(const Options& opts) : PB{host_machine(), tuning(opts)}
+    {
+        PB.registerModuleAnalyses(MAM);
+        PB.registerCGSCCAnalyses(CGAM);
+        PB.registerFunctionAnalyses(FAM);
+        PB.registerLoopAnalyses(LAM);
+        PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+        if (llvm::Error err = PB.parsePassPipeline(MPM, opts.passes))
+            fail("invalid pipeline '" + opts.passes + "': " + llvm::toString(std::move(err)));
+    }
+};
+
+// per thread: the JIT optimizes on its worker threads
+static Built_Pipeline& built_pipeline(const Options& opts)
+{
+    thread_local std::map<std::string, std::unique_ptr<Built_Pipeline>> cache;
+    std::unique_ptr<Built_Pipeline>& p = cache[opts.text()];
+    if (!p)
+        p = std::make_unique<Built_Pipeline>(opts);
+    return *p;
+}
+
+void optimize(llvm::Module& M, const Options& opts)
+{
+    tag_loops(M, opts);
+
+    Built_Pipeline& p = built_pipeline(opts);
+    p.MPM.run(M, p.MAM);
+    // the results describe M, which the next module must not see
+    p.LAM.clear();
+    p.FAM.clear();
+    p.CGAM.clear();
+    p.MAM.clear();
+}
+
+}
@@ -0,0 +1,88 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Target/TargetMachine.h"
+
+#include <memory>
+#include <string>
+
+namespace Pipeline
+{
+
+// What the optimizer runs on the generated IR.
+// Stored as a "pipeline file", one key=value per line ('#' starts a comment):
+//   passes=default<O3>    new pass manager pipeline text, as for 'opt -passes='
+//   unroll=1              loop unrolling on/off
+//   unroll-count=0        unroll factor hinted on every loop (0: let the cost model decide)
+//   vectorize=1           loop vectorizer on/off
+//   vector-width=0        vectorization width hinted on every loop (0: cost model)
+//   slp=1                 SLP vectorizer on/off
+//   inline-threshold=-1   inliner threshold (-1: the level's default, 225 at O2, 250 at O3)
+//   fast-math=0           let codegen reassociate/contract floating point math
+struct Options {
+    std::string passes {"default<O0>"};
+    bool unroll {true};
+    unsigned unroll_count {0};
+    bool vectorize {true};
+    unsigned vector_width {0};
+    bool slp {true};
+    int inline_threshold {-1};
+    bool fast_math {false};
+
+    static Options from_opt_level(char level);
+    static Options read_file(const std::string& path);
+    void write_file(const std::string& path) const;
+    // the pipeline file's contents
+    std::string text() const;
+};
+
+// what the optimizer should report (-Rpass=<regex>, --remarks-file=...)
+struct Remarks {
+    std::string passed;   // -Rpass=: passes whose applied optimizations are printed
+    std::string missed;   // -Rpass-missed=: ... whose missed optimizations are printed
+    std::string analysis; // -Rpass-analysis=: ... whose analysis results are printed
+    std::string file;     // --remarks-file=: every remark, serialized as YAML
+    bool stats {false};   // --print-stats: llvm::Statistic counters after the pipeline
+
+    bool any() const { return !passed.empty() || !missed.empty() || !analysis.empty() || !file.empty(); }
+};
+
+// remarks go to stderr as 'file:line:col: remark: ...' (a location needs -g);
+// the YAML file is written to 'file' (one per context, so chunks pass their own name)
+void enable_remarks(llvm::LLVMContext& ctx, const Remarks& remarks, const std::string& file);
+
+// the same for a context that is optimized on its own thread (the JIT):
+// the caller owns the YAML file and keeps it once the context is compiled.
+// The statistics are turned on with enable_statistics() up front.
+std::unique_ptr<llvm::ToolOutputFile> open_remarks(llvm::LLVMContext& ctx, const Remarks& remarks, const std::string& file);
+void enable_statistics(const Remarks& remarks);
+
+// closes the YAML file and prints the statistics, if asked for
+void finish_remarks(const Remarks& remarks);
+
+// the host's target machine, created (and the native target initialized)
+// on first use
+llvm::TargetMachine *host_machine();
+
+// targets the host: sets triple and data layout, before any codegen
+void prepare_module(llvm::Module& M);
+
+// floating point flags the IRBuilder should put on every operation
+void prepare_builder(llvm::IRBuilder<>& B, const Options& opts);
+
+// tags the module's functions with the host CPU, so its vector extensions
+// (AVX/AVX2 for float4/float8) are used; the code then only runs on CPUs
+// like this one (-march=native, and always in the JIT)
+void target_host_cpu(llvm::Module& M);
+
+// the pass pipeline for an option set is built on its first use (per
+// thread) and reused for every later module, so a warmed up process only
+// pays for running it
+void optimize(llvm::Module& M, const Options& opts);
+
+}
+
+#endif
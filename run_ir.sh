@@ -1,6 +1,6 @@
 #./main main.ra > return_test.ll
 llc -filetype=obj main.ra.ll -o testing.o
-clang -no-pie testing.o -o testing.out
+clang++ -no-pie -pthread testing.o rage_runtime.o -o testing.out
 ./testing.out
 echo $?
 
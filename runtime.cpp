@@ -0,0 +1,301 @@
+#include "runtime.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <map>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using Runtime::Elem_Kind;
+
+[[noreturn]] static void fail(const char* what, const char* path)
+{
+    std::printf("Error: Runtime: %s %s: %s\n", what, path, std::strerror(errno));
+    std::exit(1);
+}
+
+// arrays rage_array_map mapped (start -> bytes), the others come from calloc
+static std::mutex mapped_mtx;
+static std::map<void*, size_t> mapped;
+
+static void release(void* p)
+{
+    std::lock_guard<std::mutex> lock {mapped_mtx};
+    auto it = mapped.find(p);
+    if (mapped.end() == it) {
+        std::free(p);
+        return;
+    }
+    munmap(it->first, it->second);
+    mapped.erase(it);
+}
+
+void* rage_array_alloc(int64_t n, int64_t elem_size)
+{
+    void* p = std::calloc(n > 0 ? static_cast<size_t>(n) : 1, static_cast<size_t>(elem_size));
+    if (!p) fail("cannot allocate", "array");
+    return p;
+}
+
+void* rage_array_map(const char* path, int64_t elem_size, int64_t* len, void* old)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) fail("cannot open", path);
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) fail("cannot stat", path);
+    if (st.st_size % elem_size) {
+        std::printf("Error: Runtime: size of %s is not a multiple of %lld bytes\n", path, static_cast<long long>(elem_size));
+        std::exit(1);
+    }
+
+    // the code indexes the array up to its declared size
+    if (st.st_size / elem_size < *len) {
+        std::printf("Error: Runtime: %s has %lld elements, the array needs %lld\n", path,
+            static_cast<long long>(st.st_size / elem_size), static_cast<long long>(*len));
+        std::exit(1);
+    }
+
+    release(old);
+    *len = st.st_size / elem_size;
+    if (0 == st.st_size) {
+        close(fd);
+        return rage_array_alloc(0, elem_size);
+    }
+
+    // private mapping: writes to the array never reach the file
+    void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (MAP_FAILED == p) fail("cannot map", path);
+    close(fd);
+    std::lock_guard<std::mutex> lock {mapped_mtx};
+    mapped[p] = static_cast<size_t>(st.st_size);
+    return p;
+}
+
+void rage_array_write(const char* path, const void* data, int64_t bytes)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) fail("cannot open", path);
+
+    // one write() unless the kernel returns short
+    const char* p = static_cast<const char*>(data);
+    while (bytes > 0) {
+        ssize_t w = write(fd, p, static_cast<size_t>(bytes));
+        if (w < 0) {
+            if (EINTR == errno) continue;
+            fail("cannot write", path);
+        }
+        p += w;
+        bytes -= w;
+    }
+    if (close(fd) < 0) fail("cannot write", path);
+}
+
+void rage_array_print(const void* data, int64_t len, int32_t kind)
+{
+    for (int64_t i = 0; i < len; ++i) {
+        switch (static_cast<Elem_Kind>(kind)) {
+        case Elem_Kind::F64: std::printf("%lf\n", static_cast<const double*>(data)[i]); break;
+        case Elem_Kind::F32: std::printf("%lf\n", static_cast<const float*>(data)[i]); break;
+        case Elem_Kind::I32: std::printf("%d\n", static_cast<const int32_t*>(data)[i]); break;
+        case Elem_Kind::I8: std::printf("%d\n", static_cast<const int8_t*>(data)[i]); break;
+        }
+    }
+}
+
+void rage_array_scan(void* data, int64_t len, int32_t kind)
+{
+    for (int64_t i = 0; i < len; ++i) {
+        double v = 0;
+        if (1 != std::scanf("%lf", &v)) break;
+        switch (static_cast<Elem_Kind>(kind)) {
+        case Elem_Kind::F64: static_cast<double*>(data)[i] = v; break;
+        case Elem_Kind::F32: static_cast<float*>(data)[i] = static_cast<float>(v); break;
+        case Elem_Kind::I32: static_cast<int32_t*>(data)[i] = static_cast<int32_t>(v); break;
+        case Elem_Kind::I8: static_cast<int8_t*>(data)[i] = static_cast<int8_t>(v); break;
+        }
+    }
+}
+
+namespace {
+
+// chunks per thread: enough for stealing to even out uneven iterations
+constexpr int64_t chunks_per_thread {8};
+
+// Thread pool for 'parallel for'. Every thread (the caller is thread 0) has
+// a deque of chunks of the range: it takes its own from the back and, once
+// they run out, steals from the front of the others'. The caller returns
+// after every thread has run out of chunks to take.
+class Pool
+{
+public:
+    explicit Pool(unsigned n_threads);
+
+    double run(int64_t lo, int64_t hi, int64_t size, double identity, int32_t op, Rage_Parallel_Body fn, void* ctx);
+
+    // a body that itself runs a parallel for does it on its own thread
+    static thread_local bool inside;
+
+private:
+    struct Chunk {
+        int64_t lo, hi;
+        size_t index;
+    };
+    struct Queue {
+        std::mutex m;
+        std::deque<Chunk> chunks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+
+    std::mutex mtx; // guards everything below
+    std::condition_variable start, done;
+    uint64_t job {0}; // bumped for every run()
+    unsigned busy {0}; // threads (other than the caller) still on the job
+    Rage_Parallel_Body fn {nullptr};
+    void* ctx {nullptr};
+    std::vector<double> parts; // one per chunk, combined in order so the result doesn't depend on scheduling
+
+    bool next_chunk(size_t self, Chunk& c);
+    void work(size_t self);
+    void thread_main(size_t self);
+};
+
+thread_local bool Pool::inside {false};
+
+double combine(int32_t op, double a, double b)
+{
+    return '*' == op ? a * b : a + b;
+}
+
+Pool::Pool(unsigned n_threads)
+{
+    for (unsigned i = 0; i < n_threads; ++i)
+        queues.push_back(std::make_unique<Queue>());
+    // never joined: the pool lives as long as the program
+    for (unsigned i = 1; i < n_threads; ++i)
+        std::thread{&Pool::thread_main, this, i}.detach();
+}
+
+bool Pool::next_chunk(size_t self, Chunk& c)
+{
+    {
+        Queue& own = *queues[self];
+        std::lock_guard<std::mutex> lock {own.m};
+        if (!own.chunks.empty()) {
+            c = own.chunks.back();
+            own.chunks.pop_back();
+            return true;
+        }
+    }
+    for (size_t i = 1; i < queues.size(); ++i) {
+        Queue& victim = *queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> lock {victim.m};
+        if (!victim.chunks.empty()) {
+            c = victim.chunks.front();
+            victim.chunks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void Pool::work(size_t self)
+{
+    inside = true;
+    Chunk c;
+    while (next_chunk(self, c))
+        parts[c.index] = fn(c.lo, c.hi, ctx);
+    inside = false;
+}
+
+void Pool::thread_main(size_t self)
+{
+    uint64_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock {mtx};
+            start.wait(lock, [&] { return job != seen; });
+            seen = job;
+        }
+        work(self);
+        std::lock_guard<std::mutex> lock {mtx};
+        if (0 == --busy)
+            done.notify_one();
+    }
+}
+
+double Pool::run(int64_t lo, int64_t hi, int64_t size, double identity, int32_t op, Rage_Parallel_Body f, void* c)
+{
+    size_t n_chunks = 0;
+    {
+        std::lock_guard<std::mutex> lock {mtx};
+        // dealt round robin; the other threads are all waiting for the job
+        for (int64_t from = lo; from < hi; from += size, ++n_chunks)
+            queues[n_chunks % queues.size()]->chunks.push_back({from, std::min(hi, from + size), n_chunks});
+        parts.assign(n_chunks, identity);
+        fn = f;
+        ctx = c;
+        busy = static_cast<unsigned>(queues.size() - 1);
+        ++job;
+    }
+    start.notify_all();
+
+    work(0);
+    {
+        std::unique_lock<std::mutex> lock {mtx};
+        done.wait(lock, [&] { return 0 == busy; });
+    }
+
+    double r = identity;
+    for (double p : parts)
+        r = combine(op, r, p);
+    return r;
+}
+
+unsigned pool_size()
+{
+    if (const char* s = std::getenv("RAGE_NUM_THREADS"))
+        return std::max(1, std::atoi(s));
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+}
+
+double rage_parallel_for(int64_t lo, int64_t hi, double identity, int32_t op, Rage_Parallel_Body fn, void* ctx)
+{
+    return rage_parallel_for_chunks(lo, hi, rage_parallel_chunk_size(lo, hi), identity, op, fn, ctx);
+}
+
+double rage_parallel_for_chunks(int64_t lo, int64_t hi, int64_t size, double identity, int32_t op, Rage_Parallel_Body fn, void* ctx)
+{
+    if (hi <= lo)
+        return identity;
+
+    // started by the first parallel for, never destroyed (see Pool::Pool)
+    static Pool* pool = new Pool{pool_size()};
+    static std::mutex one_job; // the pool runs one loop at a time
+
+    if (Pool::inside)
+        return combine(op, identity, fn(lo, hi, ctx));
+    std::lock_guard<std::mutex> lock {one_job};
+    return pool->run(lo, hi, size, identity, op, fn, ctx);
+}
+
+int64_t rage_parallel_chunk_size(int64_t lo, int64_t hi)
+{
+    static const int64_t n_threads = pool_size();
+    return std::max<int64_t>(1, (hi - lo) / (n_threads * chunks_per_thread));
+}
@@ -0,0 +1,55 @@
+#ifndef RUNTIME_HPP
+#define RUNTIME_HPP
+
+#include <cstdint>
+
+// Rage runtime library: linked into every compiled Rage program.
+// Generated code calls these by name, so they keep C linkage.
+
+namespace Runtime
+{
+
+// element types of arrays
+enum class Elem_Kind :int32_t {
+    F64=0, F32=1, I32=2, I8=3,
+};
+
+}
+
+extern "C" {
+
+// zero-initialized array of n elements
+void* rage_array_alloc(int64_t n, int64_t elem_size);
+
+// maps a raw binary file (native, i.e. little-endian, elements) copy-on-write
+// to replace the array 'old' (which is freed) of *len elements; the file must
+// have at least that many, *len becomes the number it has
+void* rage_array_map(const char* path, int64_t elem_size, int64_t* len, void* old);
+
+// writes the array's bytes to path with one write()
+void rage_array_write(const char* path, const void* data, int64_t bytes);
+
+// text i/o, one value per line, like stream.in/stream.out on a float
+void rage_array_print(const void* data, int64_t len, int32_t kind);
+void rage_array_scan(void* data, int64_t len, int32_t kind);
+
+// body of a 'parallel for': runs the iterations [lo, hi), returns their
+// part of the reduction
+typedef double (*Rage_Parallel_Body)(int64_t lo, int64_t hi, void* ctx);
+
+// runs [lo, hi) in chunks on the thread pool ($RAGE_NUM_THREADS threads,
+// default one per core) and returns identity combined with every chunk's
+// part, in order; op is '+' or '*'
+double rage_parallel_for(int64_t lo, int64_t hi, double identity, int32_t op, Rage_Parallel_Body fn, void* ctx);
+
+// the same with chunks of 'size' iterations from lo on (the interpreter
+// hands the rest of a hot loop to its compiled body this way)
+double rage_parallel_for_chunks(int64_t lo, int64_t hi, int64_t size, double identity, int32_t op, Rage_Parallel_Body fn, void* ctx);
+
+// iterations per chunk rage_parallel_for uses for [lo, hi) (the interpreter
+// splits its loops the same way, so the reductions come out the same)
+int64_t rage_parallel_chunk_size(int64_t lo, int64_t hi);
+
+}
+
+#endif
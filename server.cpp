@@ -0,0 +1,290 @@
+#include "server.hpp"
+
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+
+#include <csignal>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+// Protocol (one request per connection):
+//   client -> server: one byte carrying the client's stdin (SCM_RIGHTS),
+//                     then cwd '\0' arg1 '\0' ... argN '\0', then shutdown(SHUT_WR)
+//   server -> client: whatever the compiler printed, then '\0' and one byte exit status
+// IR text never contains a '\0', so the trailer is unambiguous.
+// Both ends only talk to a peer running as the same user (SO_PEERCRED).
+
+namespace Server
+{
+
+[[noreturn]] static void fail(const char* msg)
+{
+    std::cout << "Error: Server: " << msg << ": " << std::strerror(errno) << std::endl;
+    exit(1);
+}
+
+static bool write_all(int fd, const char* buf, size_t n)
+{
+    while (n) {
+        ssize_t w = write(fd, buf, n);
+        if (w < 0) {
+            if (EINTR == errno) continue;
+            return false;
+        }
+        buf += w;
+        n -= static_cast<size_t>(w);
+    }
+    return true;
+}
+
+static sockaddr_un make_address(const std::string& socket_path)
+{
+    sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        std::cout << "Error: Server: socket path too long: " << socket_path << std::endl;
+        exit(1);
+    }
+    std::strcpy(addr.sun_path, socket_path.c_str());
+    return addr;
+}
+
+// whoever is on the other end must be us
+static bool same_user(int fd)
+{
+    ucred cred {};
+    socklen_t len = sizeof cred;
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == getuid();
+}
+
+// a directory only we can enter: created 0700, or an existing one that is
+// ours and closed to everyone else (and not a symlink planted by someone)
+static void private_dir(const std::string& dir)
+{
+    if (mkdir(dir.c_str(), 0700) < 0 && EEXIST != errno)
+        fail(("mkdir " + dir).c_str());
+    struct stat st;
+    if (lstat(dir.c_str(), &st) < 0)
+        fail(("stat " + dir).c_str());
+    if (!S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077)) {
+        std::cout << "Error: Server: " << dir << " is not a private directory of this user" << std::endl;
+        exit(1);
+    }
+}
+
+std::string default_socket_path()
+{
+    if (const char* env = std::getenv("RAGE_SOCKET"))
+        return env;
+    if (const char* run = std::getenv("XDG_RUNTIME_DIR"))
+        return std::string{run} + "/rage.sock";
+    std::string dir {"/tmp/rage-" + std::to_string(getuid())};
+    private_dir(dir);
+    return dir + "/rage.sock";
+}
+
+// the first byte of a request, with the client's stdin attached
+static int receive_stdin(int conn)
+{
+    char byte;
+    iovec iov {&byte, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    msghdr msg {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+    ssize_t r;
+    while ((r = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC)) < 0 && EINTR == errno) {
+    }
+    cmsghdr *c = r == 1 ? CMSG_FIRSTHDR(&msg) : nullptr;
+    if (!c || SOL_SOCKET != c->cmsg_level || SCM_RIGHTS != c->cmsg_type)
+        return -1;
+    int fd;
+    std::memcpy(&fd, CMSG_DATA(c), sizeof fd);
+    return fd;
+}
+
+static bool send_stdin(int fd)
+{
+    char byte = 0;
+    iovec iov {&byte, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] {};
+    msghdr msg {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+    cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int));
+    int in = STDIN_FILENO;
+    std::memcpy(CMSG_DATA(c), &in, sizeof in);
+    ssize_t w;
+    while ((w = sendmsg(fd, &msg, 0)) < 0 && EINTR == errno) {
+    }
+    return 1 == w;
+}
+
+// runs in its own process, so the compiler's global LLVM state
+// and its exit()-on-error paths only ever affect this one request
+static int handle_request(int conn, Compile_Func compile)
+{
+    int in = receive_stdin(conn);
+    if (in < 0) {
+        close(conn);
+        return 1;
+    }
+
+    std::string req;
+    char buf[4096];
+    ssize_t r;
+    while ((r = read(conn, buf, sizeof buf)) != 0) {
+        if (r < 0) {
+            if (EINTR == errno) continue;
+            return 1;
+        }
+        req.append(buf, static_cast<size_t>(r));
+    }
+
+    std::vector<std::string> parts;
+    for (size_t begin = 0, end; begin < req.size(); begin = end + 1) {
+        end = req.find('\0', begin);
+        if (std::string::npos == end) end = req.size();
+        parts.push_back(req.substr(begin, end - begin));
+    }
+
+    int status = 1;
+    pid_t pid = parts.empty() ? -1 : fork();
+    if (0 == pid) {
+        if (chdir(parts[0].c_str()) < 0) fail("chdir");
+        dup2(in, STDIN_FILENO); // 'stream.in' under --run reads the client's input
+        dup2(conn, STDOUT_FILENO);
+        dup2(conn, STDERR_FILENO);
+        close(in);
+        close(conn);
+
+        std::vector<char*> argv {const_cast<char*>("rage")};
+        for (size_t i = 1; i < parts.size(); ++i)
+            argv.push_back(&parts[i][0]);
+        argv.push_back(nullptr);
+        exit(compile(static_cast<int>(argv.size()) - 1, argv.data()));
+    }
+    close(in);
+
+    int wstatus;
+    if (pid > 0 && waitpid(pid, &wstatus, 0) == pid && WIFEXITED(wstatus))
+        status = WEXITSTATUS(wstatus);
+
+    char trailer[2] {'\0', static_cast<char>(status)};
+    write_all(conn, trailer, sizeof trailer);
+    close(conn);
+    return 0;
+}
+
+int run_server(const std::string& socket_path, Compile_Func compile, Warm_Up_Func warm_up)
+{
+    // before the first fork: the children inherit whatever it set up
+    if (warm_up)
+        warm_up();
+
+    sockaddr_un addr = make_address(socket_path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) fail("socket");
+    unlink(socket_path.c_str());
+    // created 0600 (no window where others could connect), then pinned to it
+    mode_t old_mask = umask(0177);
+    int bound = bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr);
+    umask(old_mask);
+    if (bound < 0) fail("bind");
+    if (chmod(socket_path.c_str(), 0600) < 0) fail("chmod");
+    if (listen(listen_fd, SOMAXCONN) < 0) fail("listen");
+
+    // request handlers are never waited on
+    std::signal(SIGCHLD, SIG_IGN);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    std::cout << "rage: serving on " << socket_path << std::endl;
+
+    while (true) {
+        int conn = accept(listen_fd, nullptr, nullptr);
+        if (conn < 0) {
+            if (EINTR == errno || ECONNABORTED == errno) continue;
+            fail("accept");
+        }
+        if (!same_user(conn)) {
+            close(conn);
+            continue;
+        }
+
+        pid_t pid = fork();
+        if (0 == pid) {
+            close(listen_fd);
+            std::signal(SIGCHLD, SIG_DFL); // handler waits for its compiler process
+            _exit(handle_request(conn, compile));
+        }
+        if (pid < 0)
+            std::cout << "Error: Server: fork: " << std::strerror(errno) << std::endl;
+        close(conn);
+    }
+}
+
+int run_client(const std::string& socket_path, const std::vector<std::string>& args)
+{
+    sockaddr_un addr = make_address(socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) fail("socket");
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) < 0)
+        fail(("connect to " + socket_path).c_str());
+    if (!same_user(fd)) {
+        std::cout << "Error: Server: " << socket_path << " is served by another user" << std::endl;
+        return 1;
+    }
+
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof cwd)) fail("getcwd");
+
+    std::string req {cwd};
+    req.push_back('\0');
+    for (const auto& a : args) {
+        req += a;
+        req.push_back('\0');
+    }
+    if (!send_stdin(fd)) fail("sendmsg");
+    if (!write_all(fd, req.data(), req.size())) fail("write");
+    shutdown(fd, SHUT_WR);
+
+    // stream the output through, holding back the last two bytes (the trailer)
+    std::string pending;
+    char buf[1 << 16];
+    ssize_t r;
+    while ((r = read(fd, buf, sizeof buf)) != 0) {
+        if (r < 0) {
+            if (EINTR == errno) continue;
+            fail("read");
+        }
+        pending.append(buf, static_cast<size_t>(r));
+        if (pending.size() > 2) {
+            size_t n = pending.size() - 2;
+            write_all(STDOUT_FILENO, pending.data(), n);
+            pending.erase(0, n);
+        }
+    }
+    close(fd);
+
+    if (pending.size() != 2 || pending[0] != '\0') {
+        std::cout << "Error: Server: connection closed before the request finished" << std::endl;
+        return 1;
+    }
+    return static_cast<unsigned char>(pending[1]);
+}
+
+}
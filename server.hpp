@@ -0,0 +1,29 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include <string>
+#include <vector>
+
+namespace Server
+{
+
+// the compiler's normal entry point, called once per request
+// in a freshly forked process (so every request gets its own LLVMContext)
+using Compile_Func = int (*)(int argc, char* argv[]);
+// run once before serving, so every forked request starts warm
+using Warm_Up_Func = void (*)();
+
+// socket used when RAGE_SOCKET is not set
+std::string default_socket_path();
+
+// 'rage --server': keeps the process (and LLVM's static state) alive
+// and serves compile requests on a local unix socket, one fork per request
+int run_server(const std::string& socket_path, Compile_Func compile, Warm_Up_Func warm_up = nullptr);
+
+// 'rage --client <args>': forwards the arguments and the working directory
+// to the server, copies the output back and returns the compiler's exit code
+int run_client(const std::string& socket_path, const std::vector<std::string>& args);
+
+}
+
+#endif